@@ -119,12 +119,14 @@ void update_zynswitch(uint8_t i, uint8_t status) {
 			zsw->tsus=0;
 			//printf("Debounced Switch %d\n",i);
 			zsw->dtus=dtus;
+			notify_zynui_event();
 		}
 	}
 	//Push
 	else if (zsw->status==0) {
 		zsw->push=1;
 		zsw->tsus=tsus;		// Save push timestamp
+		notify_zynui_event();
 	}
 	//Send MIDI
 	send_zynswitch_midi(zsw, status);
@@ -454,6 +456,7 @@ void update_zyncoder(uint8_t i, uint8_t msb, uint8_t lsb) {
 	if (zcdr->value!=value) {
 		zcdr->value=value;
 		zcdr->value_flag = 1;
+		notify_zynui_event();
 		if (zcdr->zpot_i>=0) {
 			send_zynpot(zcdr->zpot_i);
 		}
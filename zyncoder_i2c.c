@@ -32,11 +32,13 @@
 #include <string.h>
 #include <math.h>
 #include <time.h>
+#include <stdatomic.h>
 #include <unistd.h>
 
 #include <wiringPi.h>
 #include <wiringPiI2C.h>
 
+#include "zynpot.h"
 #include "zyncoder_i2c.h"
 
 //#define DEBUG
@@ -80,8 +82,12 @@ void update_zynswitch(uint8_t i, uint8_t status) {
 			zynswitch->tsus=0;
 			if (dtus<1000) return;
 			zynswitch->dtus=dtus;
+			notify_zynui_event();
 		}
-	} else zynswitch->tsus=tsus;
+	} else {
+		zynswitch->tsus=tsus;
+		notify_zynui_event();
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -162,17 +168,59 @@ unsigned int get_zynswitch(uint8_t i, unsigned int long_dtus) {
 // Incremental Rotary Encoders
 //-----------------------------------------------------------------------------
 
+// First enabled encoder bound to each (chan, ctrl), as index+1 => 0 if none,
+// so the zero-initialized index is valid before reset_zyncoders(). Encoders
+// sharing a binding are chained by "zyncoder_midi_next" (index+1 too). Links
+// are stored with release and walked with acquire, and an unbound encoder keeps
+// its link, so a reader walking it while it's moved ends in one of the chains
+// and filters on the binding.
+atomic_int_least8_t zyncoder_midi_index[16][128];
+atomic_int_least8_t zyncoder_midi_next[MAX_NUM_ZYNCODERS];
+
+/** @brief  Remove encoder from the MIDI reverse index
+*   @param  i Index of encoder
+*/
+void unbind_midi_zyncoder(uint8_t i) {
+	struct zyncoder_st *zyncoder = zyncoders + i;
+	atomic_int_least8_t *pj = &zyncoder_midi_index[zyncoder->midi_chan][zyncoder->midi_ctrl];
+	int j;
+	while ((j=atomic_load_explicit(pj, memory_order_relaxed))>0) {
+		if (j==i+1) {
+			atomic_store_explicit(pj, atomic_load_explicit(&zyncoder_midi_next[i], memory_order_relaxed), memory_order_release);
+			break;
+		}
+		pj = &zyncoder_midi_next[j-1];
+	}
+}
+
+/** @brief  Bind encoder to MIDI controller in the reverse index
+*   @param  i Index of encoder
+*   @param  midi_chan MIDI channel
+*   @param  midi_ctrl MIDI controller
+*/
+void bind_midi_zyncoder(uint8_t i, uint8_t midi_chan, uint8_t midi_ctrl) {
+	struct zyncoder_st *zyncoder = zyncoders + i;
+	if (zyncoder->enabled) unbind_midi_zyncoder(i);
+	zyncoder->midi_chan = midi_chan;
+	zyncoder->midi_ctrl = midi_ctrl;
+	atomic_store_explicit(&zyncoder_midi_next[i], atomic_load_explicit(&zyncoder_midi_index[midi_chan][midi_ctrl], memory_order_relaxed), memory_order_release);
+	atomic_store_explicit(&zyncoder_midi_index[midi_chan][midi_ctrl], i+1, memory_order_release);
+}
+
 /** @brief Set encoder value from MIDI event
 *   @param  midi_chan MIDI channel
 *   @param  midi_ctrl MIDI controller
 *   @param  val Value to set encoder to
 */
 void midi_event_zyncoders(uint8_t midi_chan, uint8_t midi_ctrl, uint8_t val) {
-	//Update zyncoder value => TODO Optimize this fragment!!!
-	int j;
-	for (j=0;j<MAX_NUM_ZYNCODERS;j++) {
-		if (zyncoders[j].enabled && zyncoders[j].midi_chan==midi_chan && zyncoders[j].midi_ctrl==midi_ctrl) {
-			zyncoders[j].value=val;
+	int i, j, n;
+	if (midi_chan>15 || midi_ctrl>127) return;
+	j = atomic_load_explicit(&zyncoder_midi_index[midi_chan][midi_ctrl], memory_order_acquire);
+	for (n=0;j>0 && n<MAX_NUM_ZYNCODERS;n++) {
+		i=j-1;
+		j = atomic_load_explicit(&zyncoder_midi_next[i], memory_order_acquire);
+		if (zyncoders[i].enabled && zyncoders[i].midi_chan==midi_chan && zyncoders[i].midi_ctrl==midi_ctrl) {
+			zyncoders[i].value=val;
 			//fprintf (stdout, "ZynMidiRouter: MIDI CC (%x, %x) => UI",midi_chan,midi_ctrl);
 		}
 	}
@@ -222,7 +270,7 @@ void send_zyncoder(uint8_t i) {
 *   @retval int 0=error, 1=success
 */
 int setup_zyncoder(uint8_t i, uint8_t pin_a, uint8_t pin_b, uint8_t midi_chan, uint8_t midi_ctrl, char *osc_path, unsigned int value, unsigned int max_value, unsigned int step) {
-	if (i > MAX_NUM_ZYNCODERS) {
+	if (i >= MAX_NUM_ZYNCODERS) {
 		printf("ZynCore: Zyncoder index %d out of range!\n", i);
 		return 0;
 	}
@@ -235,8 +283,7 @@ int setup_zyncoder(uint8_t i, uint8_t pin_a, uint8_t pin_b, uint8_t midi_chan, u
 	if (midi_chan>15) midi_chan=0;
 	if (midi_ctrl>127) midi_ctrl=1;
 	if (value>max_value) value=max_value;
-	zyncoder->midi_chan = midi_chan;
-	zyncoder->midi_ctrl = midi_ctrl;
+	bind_midi_zyncoder(i, midi_chan, midi_ctrl);
 	zyncoder->index = pin_a + 114; // I2C encoders start at register 115
 	zyncoder->step = step;
 
@@ -338,8 +385,10 @@ void reset_zyncoders() {
 		zynswitches[i].enabled=0;
 		zynswitches[i].midi_cc=0;
 	}
+	for (i=0;i<16*128;i++) atomic_store(&zyncoder_midi_index[i/128][i%128], 0);
 	for (i=0;i<MAX_NUM_ZYNCODERS;i++) {
 		zyncoders[i].enabled=0;
+		atomic_store(&zyncoder_midi_next[i], 0);
 	}
 }
 
@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <poll.h>
 
 #include "zynpot.h"
 #include "zyncoder.h"
@@ -62,8 +63,18 @@ int main() {
 	}
 	//setup_rangescale_zynpot(0, 0, 100, 50, 1);
 
+	//Wait for switch & rotary events on the UI eventfd. Timeout is needed for long-press detection.
+	struct pollfd pfd;
+	pfd.fd = get_zynui_eventfd();
+	pfd.events = POLLIN;
+
 	printf("Testing switches & rotaries...\n");
 	while(1) {
+		if (poll(&pfd, 1, 100)>0) {
+			uint64_t n;
+			if (read(pfd.fd, &n, sizeof(n))<0) n=0;
+		}
+
 		i=0;
 		while (i <= last_zynswitch_index) {
 			int dtus = get_zynswitch(i, 2000000);
@@ -75,7 +86,6 @@ int main() {
 				printf("PT-%d = %d\n", i, get_value_zynpot(i));
 			}
 		}
-		usleep(5000);
 	}
 
 	return 0;
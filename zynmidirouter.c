@@ -27,9 +27,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
 #include <jack/jack.h>
 #include <jack/midiport.h>
+#ifdef HAVE_ALSA_RAWMIDI
+#include <alsa/asoundlib.h>
+#endif
 
 #include "zynpot.h"
 #include "zynmidirouter.h"
@@ -52,6 +65,124 @@ int end_zynmidirouter() {
 	return 1;
 }
 
+//-----------------------------------------------------------------------------
+// MIDI filter configuration snapshots
+//-----------------------------------------------------------------------------
+// Lock-free triple buffer: the RT thread reads the "front" slot, the writer
+// copies "midi_filter_conf" into the "back" slot and swaps it with the "middle"
+// one, flagged as fresh. At cycle start, the RT thread swaps "front" and
+// "middle" if fresh, so it always sees a complete configuration.
+//-----------------------------------------------------------------------------
+
+#define MFC_SLOT_FRESH 4
+
+midi_filter_conf_t midi_filter_conf_slots[3];
+atomic_int midi_filter_conf_middle;
+int midi_filter_conf_back;
+int midi_filter_conf_front;
+midi_filter_conf_t *midi_filter_rt_conf;
+
+pthread_mutex_t midi_filter_conf_mutex;
+int midi_filter_conf_depth=0;
+
+void init_midi_filter_conf_slots() {
+	int i;
+	for (i=0;i<3;i++) memcpy(midi_filter_conf_slots+i, &midi_filter_conf, sizeof(midi_filter_conf_t));
+	midi_filter_conf_front=0;
+	atomic_store(&midi_filter_conf_middle, 1);
+	midi_filter_conf_back=2;
+	midi_filter_rt_conf=midi_filter_conf_slots;
+}
+
+//Called by the writer => Publish current config as a new snapshot.
+//Only the used part of the map store is copied => The RT thread never reads past "n_maps".
+void publish_midi_filter_conf() {
+	size_t size=offsetof(midi_filter_conf_t, maps)+midi_filter_conf.n_maps*sizeof(mf_map_entry_t);
+	memcpy(midi_filter_conf_slots+midi_filter_conf_back, &midi_filter_conf, size);
+	int m=atomic_exchange_explicit(&midi_filter_conf_middle, midi_filter_conf_back | MFC_SLOT_FRESH, memory_order_acq_rel);
+	midi_filter_conf_back=m & ~MFC_SLOT_FRESH;
+}
+
+//Called by the RT thread at cycle start => Get latest snapshot
+midi_filter_conf_t *acquire_midi_filter_conf() {
+	if (atomic_load_explicit(&midi_filter_conf_middle, memory_order_relaxed) & MFC_SLOT_FRESH) {
+		int m=atomic_exchange_explicit(&midi_filter_conf_middle, midi_filter_conf_front, memory_order_acq_rel);
+		midi_filter_conf_front=m & ~MFC_SLOT_FRESH;
+		midi_filter_rt_conf=midi_filter_conf_slots+midi_filter_conf_front;
+	}
+	return midi_filter_rt_conf;
+}
+
+//Config edits are serialized and can be nested. The snapshot is published when the outer edit ends.
+void begin_midi_filter_conf_edit() {
+	pthread_mutex_lock(&midi_filter_conf_mutex);
+	midi_filter_conf_depth++;
+}
+
+void end_midi_filter_conf_edit() {
+	if (--midi_filter_conf_depth==0) publish_midi_filter_conf();
+	pthread_mutex_unlock(&midi_filter_conf_mutex);
+}
+
+//Batch edits => Keep the edit depth open between begin & commit, from any thread,
+//so all the edits in between are applied by the RT thread in the same cycle.
+int midi_filter_begin_batch() {
+	pthread_mutex_lock(&midi_filter_conf_mutex);
+	midi_filter_conf_depth++;
+	pthread_mutex_unlock(&midi_filter_conf_mutex);
+	return 1;
+}
+
+int midi_filter_commit_batch() {
+	pthread_mutex_lock(&midi_filter_conf_mutex);
+	if (midi_filter_conf_depth<=0) {
+		pthread_mutex_unlock(&midi_filter_conf_mutex);
+		fprintf(stderr, "ZynMidiRouter: MIDI filter commit without batch!\n");
+		return 0;
+	}
+	if (--midi_filter_conf_depth==0) publish_midi_filter_conf();
+	pthread_mutex_unlock(&midi_filter_conf_mutex);
+	return 1;
+}
+
+//-----------------------------------------------------------------------------
+// Active channel note & sustain tracking
+//-----------------------------------------------------------------------------
+// Channel where each note from each zmip was sent (+1) => 0 if not sounding.
+// Note-off events are sent to the same channel, across active channel changes.
+// Owned by the RT thread.
+
+uint8_t zmip_note_owner[MAX_NUM_ZMIPS][128];
+
+// Bit j set => sustain pedal is pressed on channel j
+atomic_uint sustain_chans_mask;
+
+//Save last sustain pedal value of a channel
+void set_sustain_state(uint8_t chan, uint8_t val) {
+	midi_filter.last_ctrl_val[chan][64]=val;
+	if (val>0) atomic_fetch_or_explicit(&sustain_chans_mask, 1<<chan, memory_order_relaxed);
+	else atomic_fetch_and_explicit(&sustain_chans_mask, ~(1<<chan), memory_order_relaxed);
+}
+
+//Called by the RT thread => Save note state & active-note bitset
+void set_note_state(uint8_t chan, uint8_t note, uint8_t val) {
+	midi_filter.note_state[chan][note]=val;
+	if (val>0) MASK128_SET(midi_filter.note_mask[chan], note);
+	else MASK128_CLEAR(midi_filter.note_mask[chan], note);
+}
+
+//Called by the RT thread => Save note state from the last "n" events of a fake zmip
+void save_zmip_note_state(int iz, int n) {
+	int i;
+	for (i=zmips[iz].n_events-n;i<zmips[iz].n_events;i++) {
+		jack_midi_event_t *ev=zmips[iz].events+i;
+		if (ev->size<3) continue;
+		uint8_t type=ev->buffer[0] >> 4;
+		if (type==NOTE_ON) set_note_state(ev->buffer[0] & 0x0F, ev->buffer[1] & 0x7F, ev->buffer[2]);
+		else if (type==NOTE_OFF) set_note_state(ev->buffer[0] & 0x0F, ev->buffer[1] & 0x7F, 0);
+	}
+}
+
 //-----------------------------------------------------------------------------
 // MIDI filter management
 //-----------------------------------------------------------------------------
@@ -59,50 +190,64 @@ int end_zynmidirouter() {
 int init_midi_router() {
 	int i,j,k;
 
-	midi_filter.master_chan=-1;
-	midi_filter.active_chan=-1;
-	midi_filter.last_active_chan=-1;
-	midi_filter.tuning_pitchbend=-1;
-	midi_filter.system_events=1;
-	midi_filter.cc_automode=1;
+	pthread_mutexattr_t mutex_attr;
+	pthread_mutexattr_init(&mutex_attr);
+	pthread_mutexattr_settype(&mutex_attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&midi_filter_conf_mutex, &mutex_attr);
+	pthread_mutexattr_destroy(&mutex_attr);
+
+	midi_filter_conf.master_chan=-1;
+	midi_filter_conf.active_chan=-1;
+	midi_filter_conf.last_active_chan=-1;
+	midi_filter_conf.tuning_pitchbend=-1;
+	midi_filter_conf.system_events=1;
+	midi_filter_conf.cc_automode=1;
 	midi_learning_mode=0;
 
 	for (i=0;i<16;i++) {
 		for (j=0;j<16;j++) {
-			midi_filter.clone[i][j].enabled=0;
-			memset(midi_filter.clone[i][j].cc, 0, 128);
+			midi_filter_clone[i][j].enabled=0;
+			memset(midi_filter_clone[i][j].cc, 0, 128);
 			for (k=0;k<sizeof(default_cc_to_clone);k++) {
-				midi_filter.clone[i][j].cc[default_cc_to_clone[k] & 0x7F]=1;
+				midi_filter_clone[i][j].cc[default_cc_to_clone[k] & 0x7F]=1;
 			}
 		}
+		update_midi_filter_clone_fanout(i);
 	}
 	for (i=0;i<16;i++) {
-		midi_filter.noterange[i].note_low=0;
-		midi_filter.noterange[i].note_high=127;
-		midi_filter.noterange[i].octave_trans=0;
-		midi_filter.noterange[i].halftone_trans=0;
+		midi_filter_conf.noterange[i].note_low=0;
+		midi_filter_conf.noterange[i].note_high=127;
+		midi_filter_conf.noterange[i].octave_trans=0;
+		midi_filter_conf.noterange[i].halftone_trans=0;
 		midi_filter.last_pb_val[i]=8192;
 	}
 	for (i=0;i<8;i++) {
 		for (j=0;j<16;j++) {
 			for (k=0;k<128;k++) {
-				midi_filter.event_map[i][j][k].type=THRU_EVENT;
-				midi_filter.event_map[i][j][k].chan=j;
-				midi_filter.event_map[i][j][k].num=k;
+				midi_filter_event_map[i][j][k].type=THRU_EVENT;
+				midi_filter_event_map[i][j][k].chan=j;
+				midi_filter_event_map[i][j][k].num=k;
 			}
 		}
 	}
 	for (i=0;i<16;i++) {
 		for (j=0;j<128;j++) {
-			midi_filter.cc_swap[i][j].type=THRU_EVENT;
-			midi_filter.cc_swap[i][j].chan=i;
-			midi_filter.cc_swap[i][j].num=j;
+			midi_filter_cc_swap[i][j].type=THRU_EVENT;
+			midi_filter_cc_swap[i][j].chan=i;
+			midi_filter_cc_swap[i][j].num=j;
+			midi_filter_cc_swap_inv[i][j]=(uint16_t)i<<8 | j;
 		}
 	}
+	rebuild_midi_filter_maps();
 	memset(midi_filter.ctrl_mode, 0, 16*128);
 	memset(midi_filter.ctrl_relmode_count, 0, 16*128);
 	memset(midi_filter.last_ctrl_val, 0, 16*128);
 	memset(midi_filter.note_state, 0, 16*128);
+	memset(midi_filter.note_mask, 0, sizeof(midi_filter.note_mask));
+	memset(zmip_note_owner, 0, sizeof(zmip_note_owner));
+	atomic_store(&sustain_chans_mask, 0);
+
+	init_midi_filter_conf_slots();
 
 	return 1;
 }
@@ -118,11 +263,13 @@ void set_midi_master_chan(int chan) {
 		fprintf(stderr, "ZynMidiRouter: MIDI Master channel (%d) is out of range!\n",chan);
 		return;
 	}
-	midi_filter.master_chan=chan;
+	begin_midi_filter_conf_edit();
+	midi_filter_conf.master_chan=chan;
+	end_midi_filter_conf_edit();
 }
 
 int get_midi_master_chan() {
-	return midi_filter.master_chan;
+	return midi_filter_conf.master_chan;
 }
 
 void set_midi_active_chan(int chan) {
@@ -130,38 +277,43 @@ void set_midi_active_chan(int chan) {
 		fprintf(stderr, "ZynMidiRouter: MIDI Active channel (%d) is out of range!\n",chan);
 		return;
 	}
-	if (chan!=midi_filter.active_chan) {
-		midi_filter.last_active_chan=midi_filter.active_chan;
-		midi_filter.active_chan=chan;
+	begin_midi_filter_conf_edit();
+	if (chan!=midi_filter_conf.active_chan) {
+		midi_filter_conf.last_active_chan=midi_filter_conf.active_chan;
+		midi_filter_conf.active_chan=chan;
 	}
+	end_midi_filter_conf_edit();
 }
 
 int get_midi_active_chan() {
-	return midi_filter.active_chan;
+	return midi_filter_conf.active_chan;
 }
 
 //MIDI filter pitch-bending fine-tuning
 
 void set_midi_filter_tuning_freq(double freq) {
+	begin_midi_filter_conf_edit();
 	if (freq==440.0) {
-		midi_filter.tuning_pitchbend=-1;
+		midi_filter_conf.tuning_pitchbend=-1;
 	} else {
 		double pb=6*log((double)freq/440.0)/log(2.0);
 		if (pb<1.0 && pb>-1.0) {
-			midi_filter.tuning_pitchbend=((int)(8192.0*(1.0+pb)))&0x3FFF;
-			fprintf(stdout, "ZynMidiRouter: MIDI tuning frequency set to %f Hz (%d)\n",freq,midi_filter.tuning_pitchbend);
+			midi_filter_conf.tuning_pitchbend=((int)(8192.0*(1.0+pb)))&0x3FFF;
+			fprintf(stdout, "ZynMidiRouter: MIDI tuning frequency set to %f Hz (%d)\n",freq,midi_filter_conf.tuning_pitchbend);
 		} else {
 			fprintf(stderr, "ZynMidiRouter: MIDI tuning frequency (%f) out of range!\n",freq);
 		}
 	}
+	end_midi_filter_conf_edit();
 }
 
 int get_midi_filter_tuning_pitchbend() {
-	return midi_filter.tuning_pitchbend;
+	return midi_filter_conf.tuning_pitchbend;
 }
 
+//Called from RT thread => Use current config snapshot
 int get_tuned_pitchbend(int pb) {
-	int tpb=midi_filter.tuning_pitchbend+pb-8192;
+	int tpb=midi_filter_rt_conf->tuning_pitchbend+pb-8192;
 	if (tpb<0) tpb=0;
 	else if (tpb>16383) tpb=16383;
 	return tpb;
@@ -178,7 +330,10 @@ void set_midi_filter_clone(uint8_t chan_from, uint8_t chan_to, int v) {
 		fprintf(stderr, "ZynMidiRouter: MIDI clone chan_to (%d) is out of range!\n",chan_to);
 		return;
 	}
-	midi_filter.clone[chan_from][chan_to].enabled=v;
+	begin_midi_filter_conf_edit();
+	midi_filter_clone[chan_from][chan_to].enabled=v;
+	update_midi_filter_clone_fanout(chan_from);
+	end_midi_filter_conf_edit();
 }
 
 int get_midi_filter_clone(uint8_t chan_from, uint8_t chan_to) {
@@ -190,7 +345,7 @@ int get_midi_filter_clone(uint8_t chan_from, uint8_t chan_to) {
 		fprintf(stderr, "ZynMidiRouter: MIDI clone chan_to (%d) is out of range!\n",chan_to);
 		return 0;
 	}
-	return midi_filter.clone[chan_from][chan_to].enabled;
+	return midi_filter_clone[chan_from][chan_to].enabled;
 }
 
 void reset_midi_filter_clone(uint8_t chan_from) {
@@ -199,13 +354,16 @@ void reset_midi_filter_clone(uint8_t chan_from) {
 		return;
 	}
 	int j, k;
+	begin_midi_filter_conf_edit();
 	for (j=0;j<16;j++) {
-		midi_filter.clone[chan_from][j].enabled=0;
-		memset(midi_filter.clone[chan_from][j].cc, 0, 128);
+		midi_filter_clone[chan_from][j].enabled=0;
+		memset(midi_filter_clone[chan_from][j].cc, 0, 128);
 		for (k=0;k<sizeof(default_cc_to_clone);k++) {
-			midi_filter.clone[chan_from][j].cc[default_cc_to_clone[k] & 0x7F]=1;
+			midi_filter_clone[chan_from][j].cc[default_cc_to_clone[k] & 0x7F]=1;
 		}
 	}
+	update_midi_filter_clone_fanout(chan_from);
+	end_midi_filter_conf_edit();
 }
 
 void set_midi_filter_clone_cc(uint8_t chan_from, uint8_t chan_to, uint8_t cc[128]) {
@@ -218,9 +376,12 @@ void set_midi_filter_clone_cc(uint8_t chan_from, uint8_t chan_to, uint8_t cc[128
 		return;
 	}
 	int i;
+	begin_midi_filter_conf_edit();
 	for (i=0; i<128; i++) {
-		midi_filter.clone[chan_from][chan_to].cc[i]=cc[i];
+		midi_filter_clone[chan_from][chan_to].cc[i]=cc[i];
 	}
+	update_midi_filter_clone_fanout(chan_from);
+	end_midi_filter_conf_edit();
 }
 
 uint8_t *get_midi_filter_clone_cc(uint8_t chan_from, uint8_t chan_to) {
@@ -232,7 +393,7 @@ uint8_t *get_midi_filter_clone_cc(uint8_t chan_from, uint8_t chan_to) {
 		fprintf(stderr, "ZynMidiRouter: MIDI clone chan_to (%d) is out of range!\n",chan_to);
 		return NULL;
 	}
-	return midi_filter.clone[chan_from][chan_to].cc;
+	return midi_filter_clone[chan_from][chan_to].cc;
 }
 
 
@@ -247,9 +408,102 @@ void reset_midi_filter_clone_cc(uint8_t chan_from, uint8_t chan_to) {
 	}
 
 	int i;
-	memset(midi_filter.clone[chan_from][chan_to].cc, 0, 128);
+	begin_midi_filter_conf_edit();
+	memset(midi_filter_clone[chan_from][chan_to].cc, 0, 128);
 	for (i=0;i<sizeof(default_cc_to_clone);i++) {
-		midi_filter.clone[chan_from][chan_to].cc[default_cc_to_clone[i] & 0x7F]=1;
+		midi_filter_clone[chan_from][chan_to].cc[default_cc_to_clone[i] & 0x7F]=1;
+	}
+	update_midi_filter_clone_fanout(chan_from);
+	end_midi_filter_conf_edit();
+}
+
+//Compile the clone config of a source channel into the list of enabled targets.
+//Called from inside a config edit, or before the snapshots are initialized.
+void update_midi_filter_clone_fanout(uint8_t chan_from) {
+	int j, k, n=0;
+	mf_clone_fanout_t *fo=&midi_filter_conf.clone_fanout[chan_from & 0x0F];
+	memset(fo, 0, sizeof(mf_clone_fanout_t));
+	for (j=0;j<16;j++) {
+		if (!midi_filter_clone[chan_from][j].enabled) continue;
+		fo->chans[n]=j;
+		fo->chans_mask|=(1<<j);
+		for (k=0;k<128;k++) {
+			if (midi_filter_clone[chan_from][j].cc[k]) MASK128_SET(fo->cc_mask[n], k);
+		}
+		n++;
+	}
+	fo->n_chans=n;
+}
+
+//Sparse Event Map & CC Swap => Compile the API tables into the snapshot's presence masks & sorted mapping store.
+//Called from inside a config edit, or before the snapshots are initialized.
+
+midi_event_t *get_midi_filter_map_entry(int table, uint8_t chan, uint8_t num) {
+	if (table==MF_MAP_CC_SWAP) return &midi_filter_cc_swap[chan][num];
+	else return &midi_filter_event_map[table][chan][num];
+}
+
+//Identity entries are not stored: THRU event_map entries and cc_swap entries pointing to themselves
+int is_midi_filter_map_identity(int table, uint8_t chan, uint8_t num) {
+	midi_event_t *ev=get_midi_filter_map_entry(table, chan, num);
+	if (table==MF_MAP_CC_SWAP) return (ev->chan==chan && ev->num==num);
+	else return (ev->type==THRU_EVENT);
+}
+
+//Binary search => Index of the entry with key, or where it should be inserted
+int find_midi_filter_map(midi_filter_conf_t *mfc, uint16_t key) {
+	int lo=0;
+	int hi=mfc->n_maps;
+	while (lo<hi) {
+		int mid=(lo+hi)>>1;
+		if (mfc->maps[mid].key<key) lo=mid+1;
+		else hi=mid;
+	}
+	return lo;
+}
+
+//Used by the RT thread => NULL when the event is not mapped
+midi_event_t *lookup_midi_filter_map(midi_filter_conf_t *mfc, int table, uint8_t chan, uint8_t num) {
+	if (!MASK128_TEST(mfc->map_mask[table][chan], num)) return NULL;
+	return &mfc->maps[find_midi_filter_map(mfc, MF_MAP_KEY(table, chan, num))].ev;
+}
+
+int update_midi_filter_map(int table, uint8_t chan, uint8_t num) {
+	uint16_t key=MF_MAP_KEY(table, chan, num);
+	int i=find_midi_filter_map(&midi_filter_conf, key);
+	int found=(i<midi_filter_conf.n_maps && midi_filter_conf.maps[i].key==key);
+	if (is_midi_filter_map_identity(table, chan, num)) {
+		if (found) {
+			memmove(midi_filter_conf.maps+i, midi_filter_conf.maps+i+1, (midi_filter_conf.n_maps-i-1)*sizeof(mf_map_entry_t));
+			midi_filter_conf.n_maps--;
+			MASK128_CLEAR(midi_filter_conf.map_mask[table][chan], num);
+		}
+		return 1;
+	}
+	if (!found) {
+		if (midi_filter_conf.n_maps>=MAX_NUM_MF_MAPS) {
+			fprintf(stderr, "ZynMidiRouter: Too many MIDI filter maps (%d)!\n", MAX_NUM_MF_MAPS);
+			return 0;
+		}
+		memmove(midi_filter_conf.maps+i+1, midi_filter_conf.maps+i, (midi_filter_conf.n_maps-i)*sizeof(mf_map_entry_t));
+		midi_filter_conf.n_maps++;
+		midi_filter_conf.maps[i].key=key;
+		MASK128_SET(midi_filter_conf.map_mask[table][chan], num);
+	}
+	midi_filter_conf.maps[i].ev=*get_midi_filter_map_entry(table, chan, num);
+	return 1;
+}
+
+void rebuild_midi_filter_maps() {
+	int i, j, k;
+	memset(midi_filter_conf.map_mask, 0, sizeof(midi_filter_conf.map_mask));
+	midi_filter_conf.n_maps=0;
+	for (i=0;i<MF_MAP_TABLES;i++) {
+		for (j=0;j<16;j++) {
+			for (k=0;k<128;k++) {
+				if (!is_midi_filter_map_identity(i, j, k)) update_midi_filter_map(i, j, k);
+			}
+		}
 	}
 }
 
@@ -260,10 +514,12 @@ void set_midi_filter_note_range(uint8_t chan, uint8_t nlow, uint8_t nhigh, int8_
 		fprintf(stderr, "ZynMidiRouter: MIDI note-range chan (%d) is out of range!\n",chan);
 		return;
 	}
-	midi_filter.noterange[chan].note_low=nlow;
-	midi_filter.noterange[chan].note_high=nhigh;
-	midi_filter.noterange[chan].octave_trans=oct_trans;
-	midi_filter.noterange[chan].halftone_trans=ht_trans;
+	begin_midi_filter_conf_edit();
+	midi_filter_conf.noterange[chan].note_low=nlow;
+	midi_filter_conf.noterange[chan].note_high=nhigh;
+	midi_filter_conf.noterange[chan].octave_trans=oct_trans;
+	midi_filter_conf.noterange[chan].halftone_trans=ht_trans;
+	end_midi_filter_conf_edit();
 }
 
 void set_midi_filter_note_low(uint8_t chan, uint8_t nlow) {
@@ -271,7 +527,9 @@ void set_midi_filter_note_low(uint8_t chan, uint8_t nlow) {
 		fprintf(stderr, "ZynMidiRouter: MIDI note-range chan (%d) is out of range!\n",chan);
 		return;
 	}
-	midi_filter.noterange[chan].note_low=nlow;
+	begin_midi_filter_conf_edit();
+	midi_filter_conf.noterange[chan].note_low=nlow;
+	end_midi_filter_conf_edit();
 }
 
 void set_midi_filter_note_high(uint8_t chan, uint8_t nhigh) {
@@ -279,7 +537,9 @@ void set_midi_filter_note_high(uint8_t chan, uint8_t nhigh) {
 		fprintf(stderr, "ZynMidiRouter: MIDI note-range chan (%d) is out of range!\n",chan);
 		return;
 	}
-	midi_filter.noterange[chan].note_high=nhigh;
+	begin_midi_filter_conf_edit();
+	midi_filter_conf.noterange[chan].note_high=nhigh;
+	end_midi_filter_conf_edit();
 }
 
 void set_midi_filter_octave_trans(uint8_t chan, int8_t oct_trans) {
@@ -287,7 +547,9 @@ void set_midi_filter_octave_trans(uint8_t chan, int8_t oct_trans) {
 		fprintf(stderr, "ZynMidiRouter: MIDI note-range chan (%d) is out of range!\n",chan);
 		return;
 	}
-	midi_filter.noterange[chan].octave_trans=oct_trans;
+	begin_midi_filter_conf_edit();
+	midi_filter_conf.noterange[chan].octave_trans=oct_trans;
+	end_midi_filter_conf_edit();
 }
 
 void set_midi_filter_halftone_trans(uint8_t chan, int8_t ht_trans) {
@@ -295,7 +557,9 @@ void set_midi_filter_halftone_trans(uint8_t chan, int8_t ht_trans) {
 		fprintf(stderr, "ZynMidiRouter: MIDI note-range chan (%d) is out of range!\n",chan);
 		return;
 	}
-	midi_filter.noterange[chan].halftone_trans=ht_trans;
+	begin_midi_filter_conf_edit();
+	midi_filter_conf.noterange[chan].halftone_trans=ht_trans;
+	end_midi_filter_conf_edit();
 }
 
 uint8_t get_midi_filter_note_low(uint8_t chan) {
@@ -303,7 +567,7 @@ uint8_t get_midi_filter_note_low(uint8_t chan) {
 		fprintf(stderr, "ZynMidiRouter: MIDI note-range chan (%d) is out of range!\n",chan);
 		return 0;
 	}
-	return midi_filter.noterange[chan].note_low;
+	return midi_filter_conf.noterange[chan].note_low;
 }
 
 uint8_t get_midi_filter_note_high(uint8_t chan) {
@@ -311,7 +575,7 @@ uint8_t get_midi_filter_note_high(uint8_t chan) {
 		fprintf(stderr, "ZynMidiRouter: MIDI note-range chan (%d) is out of range!\n",chan);
 		return 0;
 	}
-	return midi_filter.noterange[chan].note_high;
+	return midi_filter_conf.noterange[chan].note_high;
 }
 
 int8_t get_midi_filter_octave_trans(uint8_t chan) {
@@ -319,7 +583,7 @@ int8_t get_midi_filter_octave_trans(uint8_t chan) {
 		fprintf(stderr, "ZynMidiRouter: MIDI note-range chan (%d) is out of range!\n",chan);
 		return 0;
 	}
-	return midi_filter.noterange[chan].octave_trans;
+	return midi_filter_conf.noterange[chan].octave_trans;
 }
 
 int8_t get_midi_filter_halftone_trans(uint8_t chan) {
@@ -327,7 +591,7 @@ int8_t get_midi_filter_halftone_trans(uint8_t chan) {
 		fprintf(stderr, "ZynMidiRouter: MIDI note-range chan (%d) is out of range!\n",chan);
 		return 0;
 	}
-	return midi_filter.noterange[chan].halftone_trans;
+	return midi_filter_conf.noterange[chan].halftone_trans;
 }
 
 void reset_midi_filter_note_range(uint8_t chan) {
@@ -335,10 +599,12 @@ void reset_midi_filter_note_range(uint8_t chan) {
 		fprintf(stderr, "ZynMidiRouter: MIDI note-range chan (%d) is out of range!\n",chan);
 		return;
 	}
-	midi_filter.noterange[chan].note_low=0;
-	midi_filter.noterange[chan].note_high=127;
-	midi_filter.noterange[chan].octave_trans=0;
-	midi_filter.noterange[chan].halftone_trans=0;
+	begin_midi_filter_conf_edit();
+	midi_filter_conf.noterange[chan].note_low=0;
+	midi_filter_conf.noterange[chan].note_high=127;
+	midi_filter_conf.noterange[chan].octave_trans=0;
+	midi_filter_conf.noterange[chan].halftone_trans=0;
+	end_midi_filter_conf_edit();
 }
 
 //Core MIDI filter functions
@@ -361,11 +627,15 @@ int validate_midi_event(midi_event_t *ev) {
 
 void set_midi_filter_event_map_st(midi_event_t *ev_from, midi_event_t *ev_to) {
 	if (validate_midi_event(ev_from) && validate_midi_event(ev_to)) {
-		//memcpy(&midi_filter.event_map[ev_from->type&0x7][ev_from->chan][ev_from->num],ev_to,sizeof(ev_to));
-		midi_event_t *event_map=&midi_filter.event_map[ev_from->type&0x7][ev_from->chan][ev_from->num];
+		//memcpy(&midi_filter_event_map[ev_from->type&0x7][ev_from->chan][ev_from->num],ev_to,sizeof(ev_to));
+		begin_midi_filter_conf_edit();
+		midi_event_t *event_map=&midi_filter_event_map[ev_from->type&0x7][ev_from->chan][ev_from->num];
+		midi_event_t prev=*event_map;
 		event_map->type=ev_to->type;
 		event_map->chan=ev_to->chan;
 		event_map->num=ev_to->num;
+		if (!update_midi_filter_map(ev_from->type&0x7, ev_from->chan, ev_from->num)) *event_map=prev;
+		end_midi_filter_conf_edit();
 	}
 }
 
@@ -377,7 +647,12 @@ void set_midi_filter_event_map(midi_event_type type_from, uint8_t chan_from, uin
 
 void set_midi_filter_event_ignore_st(midi_event_t *ev_from) {
 	if (validate_midi_event(ev_from)) {
-		midi_filter.event_map[ev_from->type&0x7][ev_from->chan][ev_from->num].type=IGNORE_EVENT;
+		begin_midi_filter_conf_edit();
+		midi_event_t *event_map=&midi_filter_event_map[ev_from->type&0x7][ev_from->chan][ev_from->num];
+		midi_event_t prev=*event_map;
+		event_map->type=IGNORE_EVENT;
+		if (!update_midi_filter_map(ev_from->type&0x7, ev_from->chan, ev_from->num)) *event_map=prev;
+		end_midi_filter_conf_edit();
 	}
 }
 
@@ -388,7 +663,7 @@ void set_midi_filter_event_ignore(midi_event_type type_from, uint8_t chan_from,
 
 midi_event_t *get_midi_filter_event_map_st(midi_event_t *ev_from) {
 	if (validate_midi_event(ev_from)) {
-		return &midi_filter.event_map[ev_from->type&0x7][ev_from->chan][ev_from->num];
+		return &midi_filter_event_map[ev_from->type&0x7][ev_from->chan][ev_from->num];
 	}
 	return NULL;
 }
@@ -400,9 +675,12 @@ midi_event_t *get_midi_filter_event_map(midi_event_type type_from, uint8_t chan_
 
 void del_midi_filter_event_map_st(midi_event_t *ev_from) {
 	if (validate_midi_event(ev_from)) {
-		midi_filter.event_map[ev_from->type&0x7][ev_from->chan][ev_from->num].type=THRU_EVENT;
-		midi_filter.event_map[ev_from->type&0x7][ev_from->chan][ev_from->num].chan=ev_from->chan;
-		midi_filter.event_map[ev_from->type&0x7][ev_from->chan][ev_from->num].num=ev_from->num;
+		begin_midi_filter_conf_edit();
+		midi_filter_event_map[ev_from->type&0x7][ev_from->chan][ev_from->num].type=THRU_EVENT;
+		midi_filter_event_map[ev_from->type&0x7][ev_from->chan][ev_from->num].chan=ev_from->chan;
+		midi_filter_event_map[ev_from->type&0x7][ev_from->chan][ev_from->num].num=ev_from->num;
+		update_midi_filter_map(ev_from->type&0x7, ev_from->chan, ev_from->num);
+		end_midi_filter_conf_edit();
 	}
 }
 
@@ -413,15 +691,18 @@ void del_midi_filter_event_map(midi_event_type type_from, uint8_t chan_from, uin
 
 void reset_midi_filter_event_map() {
 	int i,j,k;
+	begin_midi_filter_conf_edit();
 	for (i=0;i<8;i++) {
 		for (j=0;j<16;j++) {
 			for (k=0;k<128;k++) {
-				midi_filter.event_map[i][j][k].type=THRU_EVENT;
-				midi_filter.event_map[i][j][k].chan=j;
-				midi_filter.event_map[i][j][k].num=k;
+				midi_filter_event_map[i][j][k].type=THRU_EVENT;
+				midi_filter_event_map[i][j][k].chan=j;
+				midi_filter_event_map[i][j][k].num=k;
 			}
 		}
 	}
+	rebuild_midi_filter_maps();
+	end_midi_filter_conf_edit();
 }
 
 //Simple CC mapping
@@ -446,21 +727,27 @@ void del_midi_filter_cc_map(uint8_t chan_from, uint8_t cc_from) {
 
 void reset_midi_filter_cc_map() {
 	int i,j;
+	begin_midi_filter_conf_edit();
 	for (i=0;i<16;i++) {
 		for (j=0;j<128;j++) {
 			del_midi_filter_event_map(CTRL_CHANGE,i,j);
 		}
 	}
+	end_midi_filter_conf_edit();
 }
 
 //MIDI Controller Automode
 void set_midi_filter_cc_automode(int mfccam) {
-	midi_filter.cc_automode=mfccam;
+	begin_midi_filter_conf_edit();
+	midi_filter_conf.cc_automode=mfccam;
+	end_midi_filter_conf_edit();
 }
 
 //MIDI System Messages enable/disable
 void set_midi_filter_system_events(int mfse) {
-	midi_filter.system_events=mfse;
+	begin_midi_filter_conf_edit();
+	midi_filter_conf.system_events=mfse;
+	end_midi_filter_conf_edit();
 }
 
 //MIDI Learning Mode
@@ -492,25 +779,34 @@ void set_midi_learning_mode(int mlm) {
 //			=> In such a case, the previously existing CTRL_CHANGE arrow must be explicitly removed before
 //	+ Rule B: All paths are closed 
 //		+ ALGORITHM: Find the node Nh pointing to Ni
-//			=> from Ni, follow the path to find Nh that points to Ni
+//			=> midi_filter_cc_swap_inv[Ni] is Nh, updated with every arrow change
 //-----------------------------------------------------------------------------
 
 
-void _set_midi_filter_cc_swap(uint8_t chan_from, uint8_t num_from, midi_event_type type_to, uint8_t chan_to, uint8_t num_to) {
-	midi_event_t *cc_swap=&midi_filter.cc_swap[chan_from][num_from];
+int _set_midi_filter_cc_swap(uint8_t chan_from, uint8_t num_from, midi_event_type type_to, uint8_t chan_to, uint8_t num_to) {
+	midi_event_t *cc_swap=&midi_filter_cc_swap[chan_from][num_from];
+	midi_event_t prev=*cc_swap;
 	cc_swap->type=type_to;
 	cc_swap->chan=chan_to;
 	cc_swap->num=num_to;
+	if (!update_midi_filter_map(MF_MAP_CC_SWAP, chan_from, num_from)) {
+		*cc_swap=prev;
+		return 0;
+	}
+	midi_filter_cc_swap_inv[chan_to][num_to]=(uint16_t)chan_from<<8 | num_from;
+	return 1;
 }
 
 midi_event_t *_get_midi_filter_cc_swap(uint8_t chan_from, uint8_t num_from) {
-	return &midi_filter.cc_swap[chan_from][num_from];
+	return &midi_filter_cc_swap[chan_from][num_from];
 }
 
 void _del_midi_filter_cc_swap(uint8_t chan_from, uint8_t num_from) {
-	midi_filter.cc_swap[chan_from][num_from].type=THRU_EVENT;
-	midi_filter.cc_swap[chan_from][num_from].chan=chan_from;
-	midi_filter.cc_swap[chan_from][num_from].num=num_from;
+	midi_filter_cc_swap[chan_from][num_from].type=THRU_EVENT;
+	midi_filter_cc_swap[chan_from][num_from].chan=chan_from;
+	midi_filter_cc_swap[chan_from][num_from].num=num_from;
+	midi_filter_cc_swap_inv[chan_from][num_from]=(uint16_t)chan_from<<8 | num_from;
+	update_midi_filter_map(MF_MAP_CC_SWAP, chan_from, num_from);
 }
 
 
@@ -528,30 +824,32 @@ int get_mf_arrow_from(uint8_t chan, uint8_t num, mf_arrow_t *arrow) {
 	return 1;
 }
 
+//Get the arrow pointing to a node => Constant time, using the inverse table
 int get_mf_arrow_to(uint8_t chan, uint8_t num, mf_arrow_t *arrow) {
-	int limit=0;
-	arrow->chan_to=chan;
-	arrow->num_to=num;
-	//Follow the rabbit ... ;-)
-	do {
-		if (++limit>128) {
-			fprintf(stderr, "ZynMidiRouter: MIDI filter get_mf_arrow_to => Not Closed Path or it's too long!\n");
-			return 0;
-		}
-		if (!get_mf_arrow_from(arrow->chan_to,arrow->num_to,arrow)) {
-			fprintf(stderr, "ZynMidiRouter: MIDI filter get_mf_arrow_to => Bad Path!\n");
-			return 0;
-		}
+	uint16_t from=midi_filter_cc_swap_inv[chan & 0x0F][num & 0x7F];
+	if (!get_mf_arrow_from(from>>8, from & 0x7F, arrow) || arrow->chan_to!=chan || arrow->num_to!=num) {
+		fprintf(stderr, "ZynMidiRouter: MIDI filter get_mf_arrow_to => Bad Path!\n");
+		return 0;
+	}
 #ifdef DEBUG
-		fprintf(stderr, "ZynMidiRouter: MIDI filter get_mf_arrow_to %d, %d, %d => %d, %d (%d)\n", limit, arrow->chan_from, arrow->num_from, arrow->chan_to, arrow->num_to, arrow->type);
+	fprintf(stderr, "ZynMidiRouter: MIDI filter get_mf_arrow_to %d, %d => %d, %d (%d)\n", arrow->chan_from, arrow->num_from, arrow->chan_to, arrow->num_to, arrow->type);
 #endif
-	} while (arrow->chan_to!=chan || arrow->num_to!=num);
 	//Return 1 => last arrow pointing to origin!
 	return 1;
 }
 
+//A swap-map change rewrites up to 2 arrows, adding at most 2 entries to the map store.
+//Check there is room before writing any of them, so the graph is never left half-updated.
+int check_midi_filter_cc_swap_room() {
+	if (midi_filter_conf.n_maps+2>MAX_NUM_MF_MAPS) {
+		fprintf(stderr, "ZynMidiRouter: Too many MIDI filter maps (%d)!\n", MAX_NUM_MF_MAPS);
+		return 0;
+	}
+	return 1;
+}
+
 
-int set_midi_filter_cc_swap(uint8_t chan_from, uint8_t num_from, uint8_t chan_to, uint8_t num_to) {
+int _set_midi_filter_cc_swap_map(uint8_t chan_from, uint8_t num_from, uint8_t chan_to, uint8_t num_to) {
 	//---------------------------------------------------------------------------
 	//Get current arrows "from origin" and "to destiny"
 	//---------------------------------------------------------------------------
@@ -573,6 +871,7 @@ int set_midi_filter_cc_swap(uint8_t chan_from, uint8_t num_from, uint8_t chan_to
 		fprintf(stderr, "ZynMidiRouter: MIDI filter CC set swap-map => Destiny already has a CTRL_CHANGE map!\n");
 		return 0;
 	}
+	if (!check_midi_filter_cc_swap_room()) return 0;
 
 	//Create CC Map from => to
 	_set_midi_filter_cc_swap(chan_from,num_from,CTRL_CHANGE,chan_to,num_to);
@@ -593,7 +892,7 @@ int set_midi_filter_cc_swap(uint8_t chan_from, uint8_t num_from, uint8_t chan_to
 }
 
 
-int del_midi_filter_cc_swap(uint8_t chan, uint8_t num) {
+int _del_midi_filter_cc_swap_map(uint8_t chan, uint8_t num) {
 	//---------------------------------------------------------------------------
 	//Get current arrow Axy (from origin to destiny)
 	//---------------------------------------------------------------------------
@@ -611,6 +910,7 @@ int del_midi_filter_cc_swap(uint8_t chan, uint8_t num) {
 	//---------------------------------------------------------------------------
 	mf_arrow_t arrow_from;
 	if (!get_mf_arrow_from(arrow.chan_to,arrow.num_to,&arrow_from)) return 0;
+	if (!check_midi_filter_cc_swap_room()) return 0;
 
 	//---------------------------------------------------------------------------
 	//Create/Delete extra arrows for enforcing Rule A
@@ -634,11 +934,41 @@ int del_midi_filter_cc_swap(uint8_t chan, uint8_t num) {
 			//Create Ajy of type SWAP_EVENT
 			_set_midi_filter_cc_swap(arrow_to.chan_from,arrow_to.num_from,SWAP_EVENT,arrow.chan_to,arrow.num_to);
 		}
+		//Both are SWAP_EVENT => Close the path with Ajk, unless it was a 2-node path (j==y)
+		if (arrow_to.type==SWAP_EVENT && arrow_from.type==SWAP_EVENT && (arrow_to.chan_from!=arrow.chan_to || arrow_to.num_from!=arrow.num_to)) {
+			if (arrow_to.chan_from==arrow_from.chan_to && arrow_to.num_from==arrow_from.num_to) {
+				//Create Ajj of type THRU_EVENT
+				_del_midi_filter_cc_swap(arrow_to.chan_from,arrow_to.num_from);
+			} else {
+				//Create Ajk of type SWAP_EVENT
+				_set_midi_filter_cc_swap(arrow_to.chan_from,arrow_to.num_from,SWAP_EVENT,arrow_from.chan_to,arrow_from.num_to);
+			}
+		}
 	}
 
 	return 1;
 }
 
+int set_midi_filter_cc_swap(uint8_t chan_from, uint8_t num_from, uint8_t chan_to, uint8_t num_to) {
+	begin_midi_filter_conf_edit();
+	int res=_set_midi_filter_cc_swap_map(chan_from, num_from, chan_to, num_to);
+#ifdef DEBUG
+	check_midi_filter_cc_swap();
+#endif
+	end_midi_filter_conf_edit();
+	return res;
+}
+
+int del_midi_filter_cc_swap(uint8_t chan, uint8_t num) {
+	begin_midi_filter_conf_edit();
+	int res=_del_midi_filter_cc_swap_map(chan, num);
+#ifdef DEBUG
+	check_midi_filter_cc_swap();
+#endif
+	end_midi_filter_conf_edit();
+	return res;
+}
+
 uint16_t get_midi_filter_cc_swap(uint8_t chan, uint8_t num) {
 	mf_arrow_t arrow;
 	if (!get_mf_arrow_to(chan,num,&arrow)) return 0;
@@ -651,13 +981,175 @@ uint16_t get_midi_filter_cc_swap(uint8_t chan, uint8_t num) {
 
 void reset_midi_filter_cc_swap() {
 	int i,j;
+	begin_midi_filter_conf_edit();
+	for (i=0;i<16;i++) {
+		for (j=0;j<128;j++) {
+			midi_filter_cc_swap[i][j].type=THRU_EVENT;
+			midi_filter_cc_swap[i][j].chan=i;
+			midi_filter_cc_swap[i][j].num=j;
+			midi_filter_cc_swap_inv[i][j]=(uint16_t)i<<8 | j;
+		}
+	}
+	rebuild_midi_filter_maps();
+	end_midi_filter_conf_edit();
+}
+
+//Check the swap graph => Rule A & B, THRU arrows & inverse table. Return 1 if consistent.
+int check_midi_filter_cc_swap() {
+	int i, j, res=1;
+	uint8_t n_in[16][128];
+	memset(n_in, 0, sizeof(n_in));
+	//Read-only => Lock the API tables without publishing a snapshot
+	pthread_mutex_lock(&midi_filter_conf_mutex);
+	for (i=0;i<16;i++) {
+		for (j=0;j<128;j++) {
+			midi_event_t *to=&midi_filter_cc_swap[i][j];
+			if (to->chan>15 || to->num>127) {
+				fprintf(stderr, "ZynMidiRouter: MIDI filter CC swap check => Arrow from (%d, %d) to bad node (%d, %d)!\n", i, j, to->chan, to->num);
+				res=0;
+				continue;
+			}
+			if (to->type==THRU_EVENT && (to->chan!=i || to->num!=j)) {
+				fprintf(stderr, "ZynMidiRouter: MIDI filter CC swap check => THRU arrow from (%d, %d) to (%d, %d)!\n", i, j, to->chan, to->num);
+				res=0;
+			}
+			if (midi_filter_cc_swap_inv[to->chan][to->num]!=((uint16_t)i<<8 | j)) {
+				fprintf(stderr, "ZynMidiRouter: MIDI filter CC swap check => Inverse of (%d, %d) doesn't point to (%d, %d)!\n", to->chan, to->num, i, j);
+				res=0;
+			}
+			n_in[to->chan][to->num]++;
+		}
+	}
+	//Rule A => Every node receives one arrow. As every node emits one, all paths are closed (Rule B).
 	for (i=0;i<16;i++) {
 		for (j=0;j<128;j++) {
-			midi_filter.cc_swap[i][j].type=THRU_EVENT;
-			midi_filter.cc_swap[i][j].chan=i;
-			midi_filter.cc_swap[i][j].num=j;
+			if (n_in[i][j]!=1) {
+				fprintf(stderr, "ZynMidiRouter: MIDI filter CC swap check => Node (%d, %d) receives %d arrows!\n", i, j, n_in[i][j]);
+				res=0;
+			}
+		}
+	}
+	pthread_mutex_unlock(&midi_filter_conf_mutex);
+	return res;
+}
+
+//-----------------------------------------------------------------------------
+// Port Connections
+//-----------------------------------------------------------------------------
+// Backends report connection changes from a non-RT thread. The RT thread
+// rebuilds the lists of active ports when they change, so idle ports cost nothing.
+
+atomic_int zmip_port_connections[MAX_NUM_ZMIPS];
+atomic_int zmop_port_connections[MAX_NUM_ZMOPS];
+atomic_int zynmidi_ports_changed;
+
+// Incremented by the RT thread after every cycle
+atomic_uint zynmidi_cycle_count;
+
+// Port handles are read by the RT thread while they are created & destroyed.
+// They are plain pointers in the port structs, so use the compiler's atomic builtins.
+jack_port_t *load_zm_jport(jack_port_t **jport) {
+	return __atomic_load_n(jport, __ATOMIC_ACQUIRE);
+}
+
+void store_zm_jport(jack_port_t **jport, jack_port_t *port) {
+	__atomic_store_n(jport, port, __ATOMIC_RELEASE);
+}
+
+int active_zmips[MAX_NUM_ZMIPS];
+int n_active_zmips=0;
+int active_zmops[MAX_NUM_ZMOPS];
+int n_active_zmops=0;
+//Registered zmops without connections => Their buffers are cleared every cycle, so a reader
+//connected before the lists are rebuilt never gets the events of an old cycle again.
+int idle_zmops[MAX_NUM_ZMOPS];
+int n_idle_zmops=0;
+
+//Called by the backends => Add "delta" to the connection counter of a router port
+void add_port_connections(jack_port_t *port, int delta) {
+	int i;
+	if (port==NULL) return;
+	for (i=0;i<MAX_NUM_ZMIPS;i++) {
+		if (load_zm_jport(&zmips[i].jport)==port) {
+			atomic_fetch_add_explicit(&zmip_port_connections[i], delta, memory_order_relaxed);
+			set_ports_changed();
+			return;
+		}
+	}
+	for (i=0;i<MAX_NUM_ZMOPS;i++) {
+		if (load_zm_jport(&zmops[i].jport)==port) {
+			atomic_fetch_add_explicit(&zmop_port_connections[i], delta, memory_order_relaxed);
+			set_ports_changed();
+			return;
+		}
+	}
+}
+
+void set_ports_changed() {
+	atomic_store_explicit(&zynmidi_ports_changed, 1, memory_order_release);
+}
+
+int get_zmip_connections(int iz) {
+	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
+		fprintf(stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+		return 0;
+	}
+	return atomic_load_explicit(&zmip_port_connections[iz], memory_order_relaxed);
+}
+
+int get_zmop_connections(int iz) {
+	if (iz<0 || iz>=MAX_NUM_ZMOPS) {
+		fprintf(stderr, "ZynMidiRouter: Bad output port index (%d).\n", iz);
+		return 0;
+	}
+	return atomic_load_explicit(&zmop_port_connections[iz], memory_order_relaxed);
+}
+
+//Called by the RT thread at cycle start => Rebuild the active port lists if connections changed
+void update_active_ports() {
+	int i;
+	if (!atomic_exchange_explicit(&zynmidi_ports_changed, 0, memory_order_acq_rel)) return;
+
+	//Port zmips with connections or raw MIDI input. Fake zmips are fed by the ring-buffers.
+	n_active_zmips=0;
+	for (i=0;i<MAX_NUM_ZMIPS;i++) {
+		if (load_zm_jport(&zmips[i].jport)==NULL) continue;
+		if (atomic_load_explicit(&zmip_port_connections[i], memory_order_relaxed)>0 || zmip_has_rawmidi(i)) {
+			active_zmips[n_active_zmips++]=i;
 		}
 	}
+	n_active_zmops=0;
+	n_idle_zmops=0;
+	for (i=0;i<MAX_NUM_ZMOPS;i++) {
+		zmops[i].n_connections=atomic_load_explicit(&zmop_port_connections[i], memory_order_relaxed);
+		if (load_zm_jport(&zmops[i].jport)==NULL) continue;
+		if (zmops[i].n_connections>0) active_zmops[n_active_zmops++]=i;
+		else idle_zmops[n_idle_zmops++]=i;
+	}
+}
+
+//Called by the RT thread => Clear the buffers of the idle zmops
+void clear_idle_zmops(jack_nframes_t nframes) {
+	int i;
+	for (i=0;i<n_idle_zmops;i++) {
+		jack_port_t *jport=load_zm_jport(&zmops[idle_zmops[i]].jport);
+		if (jport==NULL) continue;
+		void *port_buffer=zynmidi_backend->port_get_buffer(jport, nframes);
+		if (port_buffer) zynmidi_backend->clear_buffer(port_buffer);
+	}
+}
+
+//Wait until the RT thread has run a full cycle with the current port lists => 0 on timeout
+int wait_active_ports_update() {
+	int i;
+	//Without jack client, cycles are run offline by the caller, never concurrently
+	if (jack_client==NULL) return 1;
+	unsigned int c0=atomic_load(&zynmidi_cycle_count);
+	for (i=0;i<200;i++) {
+		if (atomic_load(&zynmidi_cycle_count)-c0>=2) return 1;
+		usleep(1000);
+	}
+	return 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -669,14 +1161,19 @@ int zmop_init(int iz, char *name, int midi_chan, uint32_t flags) {
 		fprintf(stderr, "ZynMidiRouter: Bad index (%d) initializing ouput port '%s'.\n", iz, name);
 		return 0;
 	}
+	if (zmops[iz].jport) {
+		fprintf(stderr, "ZynMidiRouter: Output port index (%d) is already in use.\n", iz);
+		return 0;
+	}
 	//Create Jack Output Port
-	zmops[iz].jport = jack_port_register(jack_client, name, JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput, 0);
-	if (zmops[iz].jport == NULL) {
+	jack_port_t *jport = zynmidi_backend->port_register(name, 1);
+	if (jport == NULL) {
 		fprintf(stderr, "ZynMidiRouter: Error creating jack midi output port '%s'.\n", name);
 		return 0;
 	}
 	//Set init values
 	zmops[iz].n_connections=0;
+	atomic_store(&zmop_port_connections[iz], 0);
 	zmops[iz].flags=flags;
 
 	int i;
@@ -689,7 +1186,36 @@ int zmop_init(int iz, char *name, int midi_chan, uint32_t flags) {
 	//Reset routes
 	for (i=0;i<MAX_NUM_ZMIPS;i++)
 		zmops[iz].route_from_zmips[i]=0;
+	zmops[iz].event_counter=0;
+	zmop_update_routes(iz);
+	zmop_reset_spill(iz);
+	//Publish the port to the RT thread once it's fully set up
+	store_zm_jport(&zmops[iz].jport, jport);
+	set_ports_changed();
+
+	return 1;
+}
 
+//Remove the output port from the RT thread lists, then unregister it => 0 if the RT thread didn't release it
+int zmop_destroy(int iz) {
+	if (iz<0 || iz>=MAX_NUM_ZMOPS || zmops[iz].jport==NULL) {
+		fprintf(stderr, "ZynMidiRouter: Bad output port index (%d).\n", iz);
+		return 0;
+	}
+	jack_port_t *jport=zmops[iz].jport;
+	store_zm_jport(&zmops[iz].jport, NULL);
+	set_ports_changed();
+	if (!wait_active_ports_update()) {
+		//The RT thread may still use the port => Keep it registered
+		fprintf(stderr, "ZynMidiRouter: Timeout waiting for the RT thread to release output port (%d).\n", iz);
+		store_zm_jport(&zmops[iz].jport, jport);
+		set_ports_changed();
+		return 0;
+	}
+	zmop_reset_route_from(iz);
+	zmop_reset_spill(iz);
+	atomic_store(&zmop_port_connections[iz], 0);
+	zynmidi_backend->port_unregister(jport);
 	return 1;
 }
 
@@ -737,6 +1263,7 @@ int zmop_reset_midi_chans(int iz) {
 	int i;
 	for (i=0;i<16;i++)
 		zmops[iz].midi_chans[i] = -1;
+	zmop_update_routes(iz);
 	return 1;
 }
 
@@ -753,6 +1280,7 @@ int zmop_set_midi_chan(int iz, int midi_chan_from, int midi_chan_to) {
 		midi_chan_to = -1;
 	}
 	zmops[iz].midi_chans[midi_chan_from] = midi_chan_to;
+	zmop_update_routes(iz);
 	return 1;
 }
 
@@ -776,6 +1304,7 @@ int zmop_reset_route_from(int iz) {
 	int i;
 	for (i=0;i<MAX_NUM_ZMIPS;i++)
 		zmops[iz].route_from_zmips[i] = 0;
+	zmop_update_routes(iz);
 	return 1;
 }
 
@@ -789,6 +1318,7 @@ int zmop_set_route_from(int izmop, int izmip, int route) {
 		return 0;
 	}
 	zmops[izmop].route_from_zmips[izmip]=route;
+	zmop_update_routes(izmop);
 	return 1;
 }
 
@@ -809,135 +1339,650 @@ int zmop_reset_event_counters(int iz) {
 		fprintf(stderr, "ZynMidiRouter: Bad output port index (%d).\n", iz);
 		return 0;
 	}
-	int i;
-	for (i=0;i<MAX_NUM_ZMIPS;i++)
-		zmops[iz].event_counter[i]=0;
+	zmops[iz].event_counter=0;
+	return 1;
 }
 
-jack_midi_event_t *zmop_pop_event(int izmop, int *izmip) {
-	if (izmop<0 || izmop>=MAX_NUM_ZMOPS) {
-		fprintf(stderr, "ZynMidiRouter: Bad output port index (%d).\n", izmop);
+//Compile zmop routing config (route_from_zmips & midi_chans) into the fan-out
+//tables used for calculating event destinations.
+int zmop_update_routes(int iz) {
+	if (iz<0 || iz>=MAX_NUM_ZMOPS) {
+		fprintf(stderr, "ZynMidiRouter: Bad output port index (%d).\n", iz);
 		return 0;
 	}
+	struct zmop_st *zmop=zmops+iz;
+	uint32_t zmop_bit=(uint32_t)1<<iz;
+	int i;
 
-	jack_nframes_t t=0xffffffff;
-	*izmip=-1;
+	begin_midi_filter_conf_edit();
 
-	//Search next event from poll of routed zmips
-	int i;
 	for (i=0;i<MAX_NUM_ZMIPS;i++) {
-		if (zmops[izmop].route_from_zmips[i]) {
-			int ci=zmops[izmop].event_counter[i];
-			if (ci<zmips[i].n_events) {
-				if (zmips[i].events[ci].time<t) {
-					t=zmips[i].events[ci].time;
-					*izmip=i;
-				}
-			}
+		if (zmop->route_from_zmips[i]) {
+			midi_filter_conf.zmip_route_zmops[i]|=zmop_bit;
+		} else {
+			midi_filter_conf.zmip_route_zmops[i]&=~zmop_bit;
 		}
 	}
 
-	jack_midi_event_t *ev=NULL;
-	if (*izmip>=0) {
-		//Get event and increment counter
-		ev=zmips[*izmip].events+(zmops[izmop].event_counter[*izmip]++);
+	for (i=0;i<16;i++) {
+		if (zmop->midi_chans[i]>=0) {
+			midi_filter_conf.zmop_chans_trans[iz][i]=zmop->midi_chans[i] & 0x0F;
+			midi_filter_conf.chan_route_zmops[i]|=zmop_bit;
+		} else {
+			midi_filter_conf.zmop_chans_trans[iz][i]=i;
+			midi_filter_conf.chan_route_zmops[i]&=~zmop_bit;
+		}
 	}
 
-	return ev;
+	end_midi_filter_conf_edit();
+
+	return 1;
 }
 
+timeline_event_t timeline_events[MAX_NUM_TIMELINE_EVENTS];
+int n_timeline_events=0;
 
-int zmip_init(int iz, char *name, uint32_t flags) {
-	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
-		fprintf(stderr, "ZynMidiRouter: Bad index (%d) initializing input port '%s'.\n", iz, name);
+jack_midi_event_t *zmop_pop_event(int izmop, int *izmip) {
+	if (izmop<0 || izmop>=MAX_NUM_ZMOPS) {
+		fprintf(stderr, "ZynMidiRouter: Bad output port index (%d).\n", izmop);
 		return 0;
 	}
+	struct zmop_st *zmop=zmops+izmop;
 
-	if (name!=NULL) {
-		//Create Jack Output Port
-		zmips[iz].jport = jack_port_register(jack_client, name, JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
-		if (zmips[iz].jport == NULL) {
-			fprintf(stderr, "ZynMidiRouter: Error creating jack midi input port '%s'.\n", name);
-			return 0;
+	//Walk the merged timeline until next event routed to this zmop
+	uint32_t zmop_bit=(uint32_t)1<<izmop;
+	while (zmop->event_counter<n_timeline_events) {
+		timeline_event_t *tev=timeline_events+(zmop->event_counter++);
+		if (tev->zmop_mask & zmop_bit) {
+			*izmip=tev->izmip;
+			return tev->ev;
 		}
-	} else {
-		zmips[iz].jport = NULL;
 	}
-	
-	//Set init values
-	zmips[iz].flags=flags;
-	zmips[iz].n_events=0;
 
-	return 1;
+	*izmip=-1;
+	return NULL;
 }
 
-int zmip_set_flags(int iz, uint32_t flags) {
-	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
-		fprintf(stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+//Spill queue
+
+int zmop_spill_max=ZMOP_SPILL_MAX_EVENTS;
+
+int set_zmop_spill_max(int max_events) {
+	if (max_events<0) {
+		fprintf(stderr, "ZynMidiRouter: Bad spill queue max (%d).\n", max_events);
 		return 0;
 	}
-	zmips[iz].flags=flags;
+	zmop_spill_max=max_events;
 	return 1;
 }
 
-int zmip_has_flags(int iz, uint32_t flags) {
-	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
-		fprintf(stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
-		return 0;
-	}
-	return (zmips[iz].flags & flags)==flags;
+int get_zmop_spill_max() {
+	return zmop_spill_max;
 }
 
-int zmip_push_event(int iz, jack_midi_event_t *ev) {
-	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
-		fprintf(stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+int zmop_reset_spill(int iz) {
+	if (iz<0 || iz>=MAX_NUM_ZMOPS) {
+		fprintf(stderr, "ZynMidiRouter: Bad output port index (%d).\n", iz);
 		return 0;
 	}
-
-	zmips[iz].events[zmips[iz].n_events++]=*ev;
+	zmops[iz].spill.head=0;
+	zmops[iz].spill.tail=0;
+	zmops[iz].spill.n_events=0;
+	zmops[iz].spill.n_spilled=0;
+	zmops[iz].spill.n_dropped=0;
 	return 1;
 }
 
-int zmip_push_event_data(int iz, uint8_t *data) {
-	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
-		fprintf(stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+int zmop_get_spill_len(int iz) {
+	if (iz<0 || iz>=MAX_NUM_ZMOPS) {
+		fprintf(stderr, "ZynMidiRouter: Bad output port index (%d).\n", iz);
 		return 0;
 	}
-
-	jack_midi_event_t *ev=zmips[iz].events+(zmips[iz].n_events++);
-	ev->buffer=data;
-
-	uint8_t event_type=data[0] >> 4;
-	if (data[0]>=0xF4) ev->size=1;
-	else if (event_type==PROG_CHANGE || event_type==CHAN_PRESS || event_type==TIME_CODE_QF || event_type==SONG_SELECT) ev->size=2;
-	else ev->size=3;
-
-	if (zmips[iz].n_events>1) {
-		ev->time=zmips[iz].events[zmips[iz].n_events-2].time+1;
-	} else {
-		ev->time=0;
-	}
-	
-	return 1;
+	return zmops[iz].spill.n_events;
 }
 
-int zmip_clear_events(int iz) {
-	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
-		fprintf(stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+uint32_t zmop_get_spilled_events(int iz) {
+	if (iz<0 || iz>=MAX_NUM_ZMOPS) {
+		fprintf(stderr, "ZynMidiRouter: Bad output port index (%d).\n", iz);
 		return 0;
 	}
-	zmips[iz].n_events=0;
-	return 1;
+	return zmops[iz].spill.n_spilled;
+}
+
+uint32_t zmop_get_dropped_events(int iz) {
+	if (iz<0 || iz>=MAX_NUM_ZMOPS) {
+		fprintf(stderr, "ZynMidiRouter: Bad output port index (%d).\n", iz);
+		return 0;
+	}
+	return zmops[iz].spill.n_dropped;
+}
+
+//Called by the RT thread => Queue an event at the end of the spill queue
+int zmop_spill_event(struct zmop_spill_st *spill, jack_midi_data_t *data, size_t size) {
+	if (spill->n_events>=zmop_spill_max || size+2>ZMOP_SPILL_SIZE) {
+		spill->n_dropped++;
+		return 0;
+	}
+	if (spill->tail+size+2>ZMOP_SPILL_SIZE) {
+		//Compact the queue
+		memmove(spill->data, spill->data+spill->head, spill->tail-spill->head);
+		spill->tail-=spill->head;
+		spill->head=0;
+		if (spill->tail+size+2>ZMOP_SPILL_SIZE) {
+			spill->n_dropped++;
+			return 0;
+		}
+	}
+	spill->data[spill->tail]=size >> 8;
+	spill->data[spill->tail+1]=size & 0xFF;
+	memcpy(spill->data+spill->tail+2, data, size);
+	spill->tail+=size+2;
+	spill->n_events++;
+	spill->n_spilled++;
+	return 1;
+}
+
+//Called by the RT thread => Write queued events at the start of the cycle, while they fit.
+//The port buffer was just cleared, so an event that doesn't fit first can never fit (i.e. a SysEx
+//bigger than the buffer) => Drop it, or it would block the queue & every later event on the zmop.
+int zmop_flush_spill(int iz, void *port_buffer) {
+	struct zmop_spill_st *spill=&zmops[iz].spill;
+	int n=0;
+	while (spill->n_events>0) {
+		size_t size=(spill->data[spill->head] << 8) | spill->data[spill->head+1];
+		if (zynmidi_backend->event_write(port_buffer, 0, spill->data+spill->head+2, size)!=0) {
+			if (n>0) break;
+			spill->n_dropped++;
+		}
+		else n++;
+		spill->head+=size+2;
+		spill->n_events--;
+	}
+	if (spill->n_events==0) spill->head=spill->tail=0;
+	return n;
+}
+
+//Called by the RT thread => Write an event to the jack port buffer, or queue it if it doesn't fit.
+//While the queue is not empty, events are queued to keep them in order.
+int zmop_write_event(int iz, void *port_buffer, jack_nframes_t time, jack_midi_data_t *data, size_t size) {
+	struct zmop_spill_st *spill=&zmops[iz].spill;
+	if (spill->n_events==0 && zynmidi_backend->event_write(port_buffer, time, data, size)==0) return 1;
+	zmop_spill_event(spill, data, size);
+	return 0;
+}
+
+
+int zmip_init(int iz, char *name, uint32_t flags) {
+	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
+		fprintf(stderr, "ZynMidiRouter: Bad index (%d) initializing input port '%s'.\n", iz, name);
+		return 0;
+	}
+
+	if (zmips[iz].jport) {
+		fprintf(stderr, "ZynMidiRouter: Input port index (%d) is already in use.\n", iz);
+		return 0;
+	}
+	jack_port_t *jport = NULL;
+	if (name!=NULL) {
+		//Create Jack Output Port
+		jport = zynmidi_backend->port_register(name, 0);
+		if (jport == NULL) {
+			fprintf(stderr, "ZynMidiRouter: Error creating jack midi input port '%s'.\n", name);
+			return 0;
+		}
+	}
+	
+	//Set init values
+	zmips[iz].flags=flags;
+	zmips[iz].events=NULL;
+	zmips[iz].n_events=0;
+	zmips[iz].max_events=0;
+	atomic_store(&zmip_port_connections[iz], 0);
+	//Publish the port to the RT thread once it's fully set up
+	store_zm_jport(&zmips[iz].jport, jport);
+	set_ports_changed();
+
+	return 1;
+}
+
+//Remove the input port from the RT thread lists, then unregister it & its routes => 0 if the RT thread didn't release it
+int zmip_destroy(int iz) {
+	int i;
+	if (iz<0 || iz>=MAX_NUM_ZMIPS || zmips[iz].jport==NULL) {
+		fprintf(stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+		return 0;
+	}
+	zmip_close_rawmidi(iz);
+	jack_port_t *jport=zmips[iz].jport;
+	store_zm_jport(&zmips[iz].jport, NULL);
+	set_ports_changed();
+	if (!wait_active_ports_update()) {
+		//The RT thread may still use the port => Keep it registered
+		fprintf(stderr, "ZynMidiRouter: Timeout waiting for the RT thread to release input port (%d).\n", iz);
+		store_zm_jport(&zmips[iz].jport, jport);
+		set_ports_changed();
+		return 0;
+	}
+	midi_filter_begin_batch();
+	for (i=0;i<MAX_NUM_ZMOPS;i++) {
+		if (zmops[i].route_from_zmips[iz]) zmop_set_route_from(i, iz, 0);
+	}
+	midi_filter_commit_batch();
+	atomic_store(&zmip_port_connections[iz], 0);
+	zynmidi_backend->port_unregister(jport);
+	return 1;
+}
+
+int zmip_set_flags(int iz, uint32_t flags) {
+	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
+		fprintf(stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+		return 0;
+	}
+	zmips[iz].flags=flags;
+	return 1;
+}
+
+int zmip_has_flags(int iz, uint32_t flags) {
+	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
+		fprintf(stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+		return 0;
+	}
+	return (zmips[iz].flags & flags)==flags;
+}
+
+int zmip_push_event(int iz, jack_midi_event_t *ev) {
+	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
+		fprintf(stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+		return 0;
+	}
+
+	if (zmips[iz].n_events>=zmips[iz].max_events) return 0;
+
+	zmips[iz].events[zmips[iz].n_events++]=*ev;
+	return 1;
+}
+
+int zmip_push_event_data(int iz, uint8_t *data, size_t size, jack_nframes_t time) {
+	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
+		fprintf(stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+		return 0;
+	}
+	if (zmips[iz].n_events>=zmips[iz].max_events) return 0;
+
+	jack_midi_event_t *ev=zmips[iz].events+(zmips[iz].n_events++);
+	ev->buffer=data;
+	ev->size=size;
+
+	//Keep events sorted by time
+	if (zmips[iz].n_events>1 && time<zmips[iz].events[zmips[iz].n_events-2].time) {
+		ev->time=zmips[iz].events[zmips[iz].n_events-2].time;
+	} else {
+		ev->time=time;
+	}
+	return 1;
+}
+
+int zmip_clear_events(int iz) {
+	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
+		fprintf(stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+		return 0;
+	}
+	zmips[iz].n_events=0;
+	return 1;
+}
+
+//Shared zmip event pool => Segments are taken in processing order, so only the
+//last opened zmip can grow. Owned by the RT thread.
+jack_midi_event_t zmip_event_pool[ZMIP_EVENT_POOL_SIZE];
+int zmip_event_pool_used=0;
+int pool_zmips[MAX_NUM_ZMIPS];
+int n_pool_zmips=0;
+uint8_t pool_zmip_opened[MAX_NUM_ZMIPS];		// Zmip has a segment in this cycle
+
+//Called by the RT thread => Give the zmip the free part of the pool, closing the previous segment.
+//Reopening the last zmip keeps its segment. An earlier one can't grow anymore => 0
+int zmip_open_events(int iz) {
+	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
+		fprintf(stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+		return 0;
+	}
+	if (pool_zmip_opened[iz]) return (pool_zmips[n_pool_zmips-1]==iz);
+	if (n_pool_zmips>0) {
+		int last=pool_zmips[n_pool_zmips-1];
+		zmip_event_pool_used+=zmips[last].n_events;
+		zmips[last].max_events=zmips[last].n_events;
+	}
+	if (n_pool_zmips>=MAX_NUM_ZMIPS) return 0;
+	int max_events=ZMIP_EVENT_POOL_SIZE-zmip_event_pool_used;
+	if (max_events>JACK_MIDI_BUFFER_SIZE) max_events=JACK_MIDI_BUFFER_SIZE;
+	zmips[iz].events=zmip_event_pool+zmip_event_pool_used;
+	zmips[iz].n_events=0;
+	zmips[iz].max_events=max_events;
+	pool_zmips[n_pool_zmips++]=iz;
+	pool_zmip_opened[iz]=1;
+	return 1;
 }
 
 int zmips_clear_events() {
 	int i;
+	for (i=0;i<n_pool_zmips;i++) {
+		zmips[pool_zmips[i]].n_events=0;
+		zmips[pool_zmips[i]].max_events=0;
+		pool_zmip_opened[pool_zmips[i]]=0;
+	}
+	n_pool_zmips=0;
+	zmip_event_pool_used=0;
+	n_timeline_events=0;
+	return 1;
+}
+
+//Merge the events of all zmips into a single time-ordered stream.
+//Ties are resolved by zmip index, so every zmop sees the same order as before.
+int zmips_merge_events() {
+	int active[MAX_NUM_ZMIPS];
+	int counter[MAX_NUM_ZMIPS];
+	int n_active=0;
+	int i;
+	midi_filter_conf_t *mfc=midi_filter_rt_conf;
+
+	n_timeline_events=0;
+
+	//Only zmips having events take part in the merge. They were opened in index order.
+	for (i=0;i<n_pool_zmips;i++) {
+		if (zmips[pool_zmips[i]].n_events>0) {
+			active[n_active]=pool_zmips[i];
+			counter[n_active]=0;
+			n_active++;
+		}
+	}
+
+	while (n_active>0) {
+		//Get the zmip with the earliest pending event
+		int k=0;
+		jack_nframes_t t=zmips[active[0]].events[counter[0]].time;
+		for (i=1;i<n_active;i++) {
+			if (zmips[active[i]].events[counter[i]].time<t) {
+				t=zmips[active[i]].events[counter[i]].time;
+				k=i;
+			}
+		}
+
+		if (n_timeline_events>=MAX_NUM_TIMELINE_EVENTS) {
+			fprintf(stderr, "ZynMidiRouter: Event timeline is full!\n");
+			break;
+		}
+		timeline_event_t *tev=timeline_events+(n_timeline_events++);
+		tev->ev=zmips[active[k]].events+counter[k];
+		tev->izmip=active[k];
+		//Destination zmops => zmip routes, and channel filter for channel messages
+		tev->zmop_mask=mfc->zmip_route_zmops[active[k]];
+		uint8_t status=tev->ev->buffer[0];
+		if (status>=0x80 && status<SYSTEM_EXCLUSIVE) tev->zmop_mask&=mfc->chan_route_zmops[status & 0x0F];
+
+		//Drop exhausted zmips, keeping the remaining ones in index order
+		if (++counter[k]>=zmips[active[k]].n_events) {
+			n_active--;
+			for (i=k;i<n_active;i++) {
+				active[i]=active[i+1];
+				counter[i]=counter[i+1];
+			}
+		}
+	}
+
+	return n_timeline_events;
+}
+
+//-----------------------------------------------------------------------------
+// MIDI Port Backends
+//-----------------------------------------------------------------------------
+
+//JACK backend => Buffer & event functions are jack's ones
+
+jack_port_t *jack_backend_port_register(const char *name, int output) {
+	return jack_port_register(jack_client, name, JACK_DEFAULT_MIDI_TYPE, output ? JackPortIsOutput : JackPortIsInput, 0);
+}
+
+int jack_backend_port_unregister(jack_port_t *port) {
+	return jack_port_unregister(jack_client, port)==0;
+}
+
+//Called by jackd from its notification thread
+void jack_backend_port_connect(jack_port_id_t a, jack_port_id_t b, int connect, void *arg) {
+	jack_port_t *port;
+	port=jack_port_by_id(jack_client, a);
+	if (port && jack_port_is_mine(jack_client, port)) add_port_connections(port, connect ? 1 : -1);
+	port=jack_port_by_id(jack_client, b);
+	if (port && jack_port_is_mine(jack_client, port)) add_port_connections(port, connect ? 1 : -1);
+}
+
+jack_nframes_t jack_backend_last_frame_time() {
+	return jack_last_frame_time(jack_client);
+}
+
+jack_nframes_t jack_backend_frame_time() {
+	return jack_frame_time(jack_client);
+}
+
+jack_nframes_t jack_backend_get_sample_rate() {
+	return jack_get_sample_rate(jack_client);
+}
+
+zynmidi_backend_t zynmidi_jack_backend={
+	.name="jack",
+	.port_register=jack_backend_port_register,
+	.port_unregister=jack_backend_port_unregister,
+	.port_get_buffer=jack_port_get_buffer,
+	.get_event_count=jack_midi_get_event_count,
+	.event_get=jack_midi_event_get,
+	.clear_buffer=jack_midi_clear_buffer,
+	.event_write=jack_midi_event_write,
+	.last_frame_time=jack_backend_last_frame_time,
+	.frame_time=jack_backend_frame_time,
+	.get_sample_rate=jack_backend_get_sample_rate
+};
+
+//Offline backend => Port handles are offline_port_t, being also the port buffer
+
+offline_port_t *offline_ports[MAX_NUM_ZMIPS+MAX_NUM_ZMOPS];
+int offline_n_ports=0;
+jack_nframes_t offline_nframes=0;
+jack_nframes_t offline_sample_rate=0;
+jack_nframes_t offline_frame_time=0;
+
+jack_port_t *offline_port_register(const char *name, int output) {
+	if (offline_n_ports>=MAX_NUM_ZMIPS+MAX_NUM_ZMOPS) return NULL;
+	offline_port_t *port=(offline_port_t *)calloc(1, sizeof(offline_port_t));
+	if (port==NULL) return NULL;
+	strncpy(port->name, name, sizeof(port->name)-1);
+	port->output=output;
+	port->n_connections=0;
+	offline_ports[offline_n_ports++]=port;
+	return (jack_port_t *)port;
+}
+
+int offline_port_unregister(jack_port_t *port) {
+	int i;
+	for (i=0;i<offline_n_ports;i++) {
+		if (offline_ports[i]==(offline_port_t *)port) {
+			free(offline_ports[i]);
+			offline_ports[i]=offline_ports[--offline_n_ports];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void *offline_port_get_buffer(jack_port_t *port, jack_nframes_t nframes) {
+	return (void *)port;
+}
+
+uint32_t offline_get_event_count(void *port_buffer) {
+	return ((offline_port_t *)port_buffer)->n_events;
+}
+
+int offline_event_get(jack_midi_event_t *ev, void *port_buffer, uint32_t index) {
+	offline_port_t *port=(offline_port_t *)port_buffer;
+	if (index>=port->n_events) return -1;
+	*ev=port->events[index];
+	return 0;
+}
+
+void offline_clear_buffer(void *port_buffer) {
+	offline_port_t *port=(offline_port_t *)port_buffer;
+	port->n_events=0;
+	port->data_used=0;
+}
+
+//Same contract as jack_midi_event_write => events must be written in time order
+int offline_event_write(void *port_buffer, jack_nframes_t time, const jack_midi_data_t *data, size_t size) {
+	offline_port_t *port=(offline_port_t *)port_buffer;
+	if (port->n_events>=OFFLINE_PORT_MAX_EVENTS || port->data_used+size>OFFLINE_PORT_DATA_SIZE) return -1;
+	if (port->n_events>0 && time<port->events[port->n_events-1].time) return -1;
+	if (offline_nframes>0 && time>=offline_nframes) return -1;
+	jack_midi_event_t *ev=port->events+port->n_events++;
+	ev->time=time;
+	ev->size=size;
+	ev->buffer=port->data+port->data_used;
+	memcpy(ev->buffer, data, size);
+	port->data_used+=size;
+	return 0;
+}
+
+jack_nframes_t offline_last_frame_time() {
+	return offline_frame_time;
+}
+
+//Events written between cycles are captured during the period before the next cycle
+jack_nframes_t offline_current_frame_time() {
+	return offline_frame_time-offline_nframes;
+}
+
+jack_nframes_t offline_get_sample_rate() {
+	return offline_sample_rate;
+}
+
+zynmidi_backend_t zynmidi_offline_backend={
+	.name="offline",
+	.port_register=offline_port_register,
+	.port_unregister=offline_port_unregister,
+	.port_get_buffer=offline_port_get_buffer,
+	.get_event_count=offline_get_event_count,
+	.event_get=offline_event_get,
+	.clear_buffer=offline_clear_buffer,
+	.event_write=offline_event_write,
+	.last_frame_time=offline_last_frame_time,
+	.frame_time=offline_current_frame_time,
+	.get_sample_rate=offline_get_sample_rate
+};
+
+//Init the router with the offline backend, instead of init_zynmidirouter
+int init_zynmidirouter_offline(jack_nframes_t nframes, jack_nframes_t sample_rate) {
+	int i;
+	if (nframes==0 || sample_rate==0) {
+		fprintf(stderr, "ZynMidiRouter: Bad offline backend config: %d frames, %d Hz\n", nframes, sample_rate);
+		return 0;
+	}
+	offline_nframes=nframes;
+	offline_sample_rate=sample_rate;
+	offline_frame_time=0;
+	zynmidi_backend=&zynmidi_offline_backend;
+	if (!init_zynmidi_buffer()) return 0;
+	if (!init_midi_router()) return 0;
+	if (!init_midi_ports(nframes)) return 0;
+	for (i=0;i<offline_n_ports;i++) {
+		offline_ports[i]->n_connections=1;
+		add_port_connections((jack_port_t *)offline_ports[i], 1);
+	}
+	return 1;
+}
+
+int end_zynmidirouter_offline() {
+	int i;
+	if (!end_midi_router()) return 0;
+	for (i=0;i<offline_n_ports;i++) free(offline_ports[i]);
+	offline_n_ports=0;
+	for (i=0;i<MAX_NUM_ZMIPS;i++) zmips[i].jport=NULL;
+	for (i=0;i<MAX_NUM_ZMOPS;i++) zmops[i].jport=NULL;
+	jack_ringbuffer_free(jack_ring_internal_buffer);
+	jack_ringbuffer_free(jack_ring_ui_buffer);
+	jack_ringbuffer_free(jack_ring_ctrlfb_buffer);
+	jack_ring_internal_buffer=jack_ring_ui_buffer=jack_ring_ctrlfb_buffer=NULL;
+	jack_ring_internal_consumed=jack_ring_ui_consumed=jack_ring_ctrlfb_consumed=0;
+	end_event_arena();
+	return 1;
+}
+
+//Run a router cycle over the pushed input events => Input ports are cleared & frame time advances
+int offline_process_cycle() {
+	int i, res;
+	res=jack_process(offline_nframes, NULL);
 	for (i=0;i<MAX_NUM_ZMIPS;i++) {
-		zmips[i].n_events=0;
+		if (zmips[i].jport) offline_clear_buffer(zmips[i].jport);
+	}
+	offline_frame_time+=offline_nframes;
+	return res;
+}
+
+jack_nframes_t offline_get_frame_time() {
+	return offline_frame_time;
+}
+
+int offline_zmip_push_event(int iz, jack_nframes_t time, jack_midi_data_t *data, size_t size) {
+	if (iz<0 || iz>=MAX_NUM_ZMIPS || zmips[iz].jport==NULL) {
+		fprintf(stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+		return 0;
+	}
+	return offline_event_write(zmips[iz].jport, time, data, size)==0;
+}
+
+int offline_zmip_clear_events(int iz) {
+	if (iz<0 || iz>=MAX_NUM_ZMIPS || zmips[iz].jport==NULL) {
+		fprintf(stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+		return 0;
 	}
+	offline_clear_buffer(zmips[iz].jport);
 	return 1;
 }
 
+int offline_zmop_set_connections(int iz, int n) {
+	if (iz<0 || iz>=MAX_NUM_ZMOPS || zmops[iz].jport==NULL) {
+		fprintf(stderr, "ZynMidiRouter: Bad output port index (%d).\n", iz);
+		return 0;
+	}
+	offline_port_t *port=(offline_port_t *)zmops[iz].jport;
+	add_port_connections(zmops[iz].jport, n-port->n_connections);
+	port->n_connections=n;
+	return 1;
+}
+
+int offline_zmip_set_connections(int iz, int n) {
+	if (iz<0 || iz>=MAX_NUM_ZMIPS || zmips[iz].jport==NULL) {
+		fprintf(stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+		return 0;
+	}
+	offline_port_t *port=(offline_port_t *)zmips[iz].jport;
+	add_port_connections(zmips[iz].jport, n-port->n_connections);
+	port->n_connections=n;
+	return 1;
+}
+
+//Output events of the last cycle
+int offline_zmop_get_event_count(int iz) {
+	if (iz<0 || iz>=MAX_NUM_ZMOPS || zmops[iz].jport==NULL) {
+		fprintf(stderr, "ZynMidiRouter: Bad output port index (%d).\n", iz);
+		return 0;
+	}
+	return ((offline_port_t *)zmops[iz].jport)->n_events;
+}
+
+int offline_zmop_get_event(int iz, int i, jack_midi_event_t *ev) {
+	if (iz<0 || iz>=MAX_NUM_ZMOPS || zmops[iz].jport==NULL) {
+		fprintf(stderr, "ZynMidiRouter: Bad output port index (%d).\n", iz);
+		return 0;
+	}
+	return offline_event_get(ev, zmops[iz].jport, i)==0;
+}
+
 //-----------------------------------------------------------------------------
 // Jack MIDI processing
 //-----------------------------------------------------------------------------
@@ -947,7 +1992,37 @@ int init_jack_midi(char *name) {
 		fprintf(stderr, "ZynMidiRouter: Error connecting with jack server.\n");
 		return 0;
 	}
+	zynmidi_backend=&zynmidi_jack_backend;
+
+	if (!init_midi_ports(jack_get_buffer_size(jack_client))) return 0;
 
+	//Init Jack Process
+	jack_set_process_callback(jack_client, jack_process, 0);
+	jack_set_buffer_size_callback(jack_client, jack_buffer_size, 0);
+	jack_set_port_connect_callback(jack_client, jack_backend_port_connect, 0);
+	if (jack_activate(jack_client)) {
+		fprintf(stderr, "ZynMidiRouter: Error activating jack client.\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+int end_jack_midi() {
+	int i;
+	if (jack_client_close(jack_client)) {
+		fprintf(stderr, "ZynMidiRouter: Error closing jack client.\n");
+	}
+	jack_client=NULL;
+	//Ports are released with the client
+	for (i=0;i<MAX_NUM_ZMIPS;i++) zmips[i].jport=NULL;
+	for (i=0;i<MAX_NUM_ZMOPS;i++) zmops[i].jport=NULL;
+	end_event_arena();
+	return 1;
+}
+
+//Create the default ports & routes => Called inside a batch, committed by the caller on every exit
+int _init_midi_ports_routing() {
 	int i,j;
 	char port_name[12];
 
@@ -1003,59 +2078,650 @@ int init_jack_midi(char *name) {
 
 	// ZMIP_CTRL is not routed to any output port, only captured by Zynthian UI
 
-	//Init Ring-Buffers
-	jack_ring_internal_buffer = jack_ringbuffer_create(JACK_MIDI_BUFFER_SIZE);
-	// lock the buffer into memory, this is *NOT* realtime safe, do it before using the buffer!
-	if (jack_ringbuffer_mlock(jack_ring_internal_buffer)) {
-		fprintf(stderr, "ZynMidiRouter: Error locking memory for internal ring-buffer.\n");
+	return 1;
+}
+
+//Create ports, default routes & ring-buffers using the current backend
+int init_midi_ports(jack_nframes_t nframes) {
+	if (!init_event_arena(nframes)) return 0;
+
+	//Publish the initial port & routing config at once
+	midi_filter_begin_batch();
+	int res=_init_midi_ports_routing();
+	midi_filter_commit_batch();
+	if (!res) return 0;
+
+	//Init Ring-Buffers
+	jack_ring_internal_buffer = jack_ringbuffer_create(JACK_MIDI_BUFFER_SIZE);
+	// lock the buffer into memory, this is *NOT* realtime safe, do it before using the buffer!
+	if (jack_ringbuffer_mlock(jack_ring_internal_buffer)) {
+		fprintf(stderr, "ZynMidiRouter: Error locking memory for internal ring-buffer.\n");
+		return 0;
+	}
+	jack_ring_ui_buffer = jack_ringbuffer_create(JACK_MIDI_BUFFER_SIZE);
+	// lock the buffer into memory, this is *NOT* realtime safe, do it before using the buffer!
+	if (jack_ringbuffer_mlock(jack_ring_ui_buffer)) {
+		fprintf(stderr, "ZynMidiRouter: Error locking memory for UI ring-buffer.\n");
+		return 0;
+	}
+	jack_ring_ctrlfb_buffer = jack_ringbuffer_create(JACK_MIDI_BUFFER_SIZE);
+	// lock the buffer into memory, this is *NOT* realtime safe, do it before using the buffer!
+	if (jack_ringbuffer_mlock(jack_ring_ctrlfb_buffer)) {
+		fprintf(stderr, "ZynMidiRouter: Error locking memory for controller feedback ring-buffer.\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+//-----------------------------------------------------
+// Per-cycle Event Arena
+//-----------------------------------------------------
+
+uint8_t *event_arena=NULL;
+size_t event_arena_size=0;
+size_t event_arena_used=0;
+uint32_t event_arena_overflows=0;
+
+int init_event_arena(jack_nframes_t nframes) {
+	size_t size=(size_t)nframes*EVENT_ARENA_BYTES_PER_FRAME;
+	if (size<EVENT_ARENA_MIN_SIZE) size=EVENT_ARENA_MIN_SIZE;
+	if (event_arena && size==event_arena_size) return 1;
+
+	uint8_t *arena=(uint8_t *)malloc(size);
+	if (arena==NULL) {
+		fprintf(stderr, "ZynMidiRouter: Error allocating event arena: %zu bytes\n", size);
+		return 0;
+	}
+	//Touch the pages now, not in the RT thread
+	memset(arena, 0, size);
+
+	free(event_arena);
+	event_arena=arena;
+	event_arena_size=size;
+	event_arena_used=0;
+	return 1;
+}
+
+void end_event_arena() {
+	free(event_arena);
+	event_arena=NULL;
+	event_arena_size=0;
+	event_arena_used=0;
+}
+
+void reset_event_arena() {
+	event_arena_used=0;
+}
+
+uint8_t *event_arena_alloc(size_t size) {
+	if (event_arena_used+size>event_arena_size) {
+		event_arena_overflows++;
+		return NULL;
+	}
+	uint8_t *data=event_arena+event_arena_used;
+	event_arena_used+=size;
+	return data;
+}
+
+uint32_t get_event_arena_overflows() {
+	return event_arena_overflows;
+}
+
+//Called by jackd when the process callback is not running
+int jack_buffer_size(jack_nframes_t nframes, void *arg) {
+	if (!init_event_arena(nframes)) return -1;
+	return 0;
+}
+
+
+//-----------------------------------------------------
+// Router Statistics
+//-----------------------------------------------------
+
+zynmidirouter_stats_t zynmidirouter_stats;
+atomic_uint zynmidirouter_stats_seq;
+atomic_int zynmidirouter_stats_reset;
+uint32_t zynmidirouter_arena_overflows_base=0;
+
+//Events lost by non-RT writers, collected by the RT thread when publishing
+atomic_uint zmip_ring_dropped[MAX_NUM_ZMIPS];
+atomic_uint zynmidi_dropped;
+
+//Called by non-RT threads => Consistent copy of the last published counters
+int get_zynmidirouter_stats(zynmidirouter_stats_t *stats) {
+	if (stats==NULL) return 0;
+	unsigned int seq;
+	do {
+		seq=atomic_load_explicit(&zynmidirouter_stats_seq, memory_order_acquire);
+		if (seq & 1) continue;
+		memcpy(stats, &zynmidirouter_stats, sizeof(zynmidirouter_stats_t));
+		atomic_thread_fence(memory_order_acquire);
+	} while (seq & 1 || seq!=atomic_load_explicit(&zynmidirouter_stats_seq, memory_order_relaxed));
+	return 1;
+}
+
+//Counters are cleared by the RT thread on next cycle
+void reset_zynmidirouter_stats() {
+	atomic_store_explicit(&zynmidirouter_stats_reset, 1, memory_order_relaxed);
+}
+
+//Called by the RT thread at the end of every cycle
+void publish_zynmidirouter_stats() {
+	int i;
+	zynmidirouter_stats_t *rts=&zynmidirouter_rt_stats;
+
+	if (atomic_exchange_explicit(&zynmidirouter_stats_reset, 0, memory_order_relaxed)) {
+		memset(rts, 0, sizeof(zynmidirouter_stats_t));
+		zynmidirouter_arena_overflows_base=get_event_arena_overflows();
+		for (i=0;i<MAX_NUM_ZMIPS;i++) atomic_store_explicit(&zmip_ring_dropped[i], 0, memory_order_relaxed);
+		atomic_store_explicit(&zynmidi_dropped, 0, memory_order_relaxed);
+	}
+
+	rts->n_cycles++;
+	rts->n_arena_overflows=get_event_arena_overflows()-zynmidirouter_arena_overflows_base;
+	if (atomic_load_explicit(&zynmidi_dropped, memory_order_relaxed)) {
+		rts->n_ui_dropped+=atomic_exchange_explicit(&zynmidi_dropped, 0, memory_order_relaxed);
+	}
+	for (i=ZMIP_FAKE_INT;i<MAX_NUM_ZMIPS;i++) {
+		if (atomic_load_explicit(&zmip_ring_dropped[i], memory_order_relaxed)) {
+			rts->zmips[i].n_dropped+=atomic_exchange_explicit(&zmip_ring_dropped[i], 0, memory_order_relaxed);
+		}
+	}
+
+	//Sequence is odd while writing
+	unsigned int seq=atomic_load_explicit(&zynmidirouter_stats_seq, memory_order_relaxed);
+	atomic_store_explicit(&zynmidirouter_stats_seq, seq+1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy(&zynmidirouter_stats, rts, sizeof(zynmidirouter_stats_t));
+	atomic_store_explicit(&zynmidirouter_stats_seq, seq+2, memory_order_release);
+}
+
+//Called by ring-buffer writers
+void count_zmip_ring_dropped(int iz) {
+	if (iz>=0 && iz<MAX_NUM_ZMIPS) atomic_fetch_add_explicit(&zmip_ring_dropped[iz], 1, memory_order_relaxed);
+}
+
+//Called by zynmidi buffer writers
+void count_zynmidi_dropped() {
+	atomic_fetch_add_explicit(&zynmidi_dropped, 1, memory_order_relaxed);
+}
+
+
+//-----------------------------------------------------
+// Cycle-time Profiler
+//-----------------------------------------------------
+
+const char *zynmidirouter_profile_stage_names[PROFILE_NUM_STAGES]={ "input", "internal", "ui", "ctrlfb", "output", "cycle" };
+
+atomic_int zynmidirouter_profiling;
+atomic_int zynmidirouter_profile_reset;
+atomic_uint zynmidirouter_profile_seq;
+zynmidirouter_profile_t zynmidirouter_rt_profile;
+zynmidirouter_profile_t zynmidirouter_profile;
+
+sem_t zynmidirouter_profile_dump_sem;
+pthread_t zynmidirouter_profile_dump_thread;
+int zynmidirouter_profile_dump_enabled=0;
+
+void set_zynmidirouter_profiling(int enable) {
+	atomic_store_explicit(&zynmidirouter_profiling, enable ? 1 : 0, memory_order_relaxed);
+}
+
+int get_zynmidirouter_profiling() {
+	return atomic_load_explicit(&zynmidirouter_profiling, memory_order_relaxed);
+}
+
+//Called by non-RT threads => Consistent copy of the last published profile
+int get_zynmidirouter_profile(zynmidirouter_profile_t *profile) {
+	if (profile==NULL) return 0;
+	unsigned int seq;
+	do {
+		seq=atomic_load_explicit(&zynmidirouter_profile_seq, memory_order_acquire);
+		if (seq & 1) continue;
+		memcpy(profile, &zynmidirouter_profile, sizeof(zynmidirouter_profile_t));
+		atomic_thread_fence(memory_order_acquire);
+	} while (seq & 1 || seq!=atomic_load_explicit(&zynmidirouter_profile_seq, memory_order_relaxed));
+	return 1;
+}
+
+//Profile is cleared by the RT thread on next profiled cycle
+void reset_zynmidirouter_profile() {
+	atomic_store_explicit(&zynmidirouter_profile_reset, 1, memory_order_relaxed);
+}
+
+//Called by the RT thread
+uint64_t profile_clock_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+void profile_add_sample(int stage, uint64_t ns) {
+	zynmidirouter_profile_t *rtp=&zynmidirouter_rt_profile;
+	uint32_t t=ns>UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+	int b=t ? 31-__builtin_clz(t) : 0;
+	if (b>=PROFILE_HIST_BUCKETS) b=PROFILE_HIST_BUCKETS-1;
+	rtp->hist[stage][b]++;
+	rtp->total_ns[stage]+=t;
+	if (t>rtp->max_ns[stage]) rtp->max_ns[stage]=t;
+}
+
+//Called by the RT thread at the end of a profiled cycle => stage_ns[i] is the time spent in stage i
+void publish_zynmidirouter_profile(uint64_t *stage_ns, jack_nframes_t nframes) {
+	int i;
+	zynmidirouter_profile_t *rtp=&zynmidirouter_rt_profile;
+
+	if (atomic_exchange_explicit(&zynmidirouter_profile_reset, 0, memory_order_relaxed)) {
+		memset(rtp, 0, sizeof(zynmidirouter_profile_t));
+	}
+
+	rtp->n_cycles++;
+	rtp->period_ns=(uint32_t)((uint64_t)nframes*1000000000/zynmidi_backend->get_sample_rate());
+	for (i=0;i<PROFILE_NUM_STAGES;i++) profile_add_sample(i, stage_ns[i]);
+	if (stage_ns[PROFILE_STAGE_CYCLE]>rtp->period_ns) rtp->n_overruns++;
+
+	//Sequence is odd while writing
+	unsigned int seq=atomic_load_explicit(&zynmidirouter_profile_seq, memory_order_relaxed);
+	atomic_store_explicit(&zynmidirouter_profile_seq, seq+1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy(&zynmidirouter_profile, rtp, sizeof(zynmidirouter_profile_t));
+	atomic_store_explicit(&zynmidirouter_profile_seq, seq+2, memory_order_release);
+}
+
+void dump_zynmidirouter_profile() {
+	zynmidirouter_profile_t prof;
+	int i, j;
+	get_zynmidirouter_profile(&prof);
+	fprintf(stderr, "ZynMidiRouter: Profile => %u cycles, %u overruns, period %u ns\n", prof.n_cycles, prof.n_overruns, prof.period_ns);
+	if (prof.n_cycles==0) return;
+	for (i=0;i<PROFILE_NUM_STAGES;i++) {
+		fprintf(stderr, "  %-8s avg %8llu ns, max %8u ns (%5.1f%% of period) |", zynmidirouter_profile_stage_names[i],
+			(unsigned long long)(prof.total_ns[i]/prof.n_cycles), prof.max_ns[i],
+			prof.period_ns ? 100.0*prof.max_ns[i]/prof.period_ns : 0.0);
+		for (j=0;j<PROFILE_HIST_BUCKETS;j++) {
+			if (prof.hist[i][j]) fprintf(stderr, " 2^%d:%u", j, prof.hist[i][j]);
+		}
+		fprintf(stderr, "\n");
+	}
+}
+
+//Signal handlers can't print => wake up the dump thread
+void profile_dump_signal_handler(int sig) {
+	sem_post(&zynmidirouter_profile_dump_sem);
+}
+
+void *profile_dump_thread(void *arg) {
+	while (1) {
+		if (sem_wait(&zynmidirouter_profile_dump_sem)==0) dump_zynmidirouter_profile();
+	}
+	return NULL;
+}
+
+//Dump the profile to stderr on SIGUSR1
+int enable_zynmidirouter_profile_dump() {
+	if (zynmidirouter_profile_dump_enabled) return 1;
+	if (sem_init(&zynmidirouter_profile_dump_sem, 0, 0)!=0) {
+		fprintf(stderr, "ZynMidiRouter: Error initializing profile dump semaphore\n");
+		return 0;
+	}
+	if (pthread_create(&zynmidirouter_profile_dump_thread, NULL, profile_dump_thread, NULL)!=0) {
+		fprintf(stderr, "ZynMidiRouter: Error creating profile dump thread\n");
+		sem_destroy(&zynmidirouter_profile_dump_sem);
+		return 0;
+	}
+	pthread_detach(zynmidirouter_profile_dump_thread);
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler=profile_dump_signal_handler;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags=SA_RESTART;
+	if (sigaction(SIGUSR1, &sa, NULL)!=0) {
+		fprintf(stderr, "ZynMidiRouter: Error installing SIGUSR1 handler\n");
+		return 0;
+	}
+	zynmidirouter_profile_dump_enabled=1;
+	return 1;
+}
+
+
+//-----------------------------------------------------
+// Raw MIDI Input <= ALSA rawmidi devices & pipes
+//-----------------------------------------------------
+// A reader thread parses the byte stream, timestamps every message with the jack
+// frame time of its first byte and writes it to a ring-buffer. The RT thread
+// merges these events with the zmip's port events, so they pass the same filters.
+
+struct zmip_rawmidi_st {
+	int iz;
+	char device[64];
+#ifdef HAVE_ALSA_RAWMIDI
+	snd_rawmidi_t *handle;
+#endif
+	int fd;							// Pipe or FIFO, when it's not an ALSA device
+	pthread_t thread;
+	atomic_int running;				// Reader thread is started => Cleared to stop it, before joining
+	atomic_int active;				// RT thread reads the ring-buffer => Cleared by the reader thread on error
+	jack_ringbuffer_t *ring;
+	size_t consumed;
+	//Parser state, owned by the reader thread
+	uint8_t status;					// Running status, 0 if none
+	int expected;					// Message length
+	uint8_t msg[ZMIP_RAWMIDI_SYSEX_SIZE];
+	int msg_len;
+	jack_nframes_t msg_time;
+	//Events of the current cycle, owned by the RT thread
+	int n_events;
+	int event_i;
+	jack_midi_event_t events[ZMIP_RAWMIDI_MAX_EVENTS];
+};
+
+//Allocated on first open, never freed, so the RT thread can always dereference it
+struct zmip_rawmidi_st * _Atomic zmip_rawmidi[MAX_NUM_ZMIPS];
+
+void zmip_rawmidi_write(struct zmip_rawmidi_st *rm, uint8_t *data, int size, jack_nframes_t time) {
+	write_ring_event_time(rm->ring, rm->iz, "raw MIDI", time, data, size);
+}
+
+//Called by the reader thread => Parse a byte, received at "time"
+void zmip_rawmidi_parse(struct zmip_rawmidi_st *rm, uint8_t b, jack_nframes_t time) {
+	//Real-time messages can be interleaved anywhere
+	if (b>=0xF8) {
+		zmip_rawmidi_write(rm, &b, 1, time);
+		return;
+	}
+	//Status byte
+	if (b & 0x80) {
+		if (b==END_SYSTEM_EXCLUSIVE) {
+			if (rm->status==SYSTEM_EXCLUSIVE && rm->msg_len<ZMIP_RAWMIDI_SYSEX_SIZE) {
+				rm->msg[rm->msg_len++]=b;
+				zmip_rawmidi_write(rm, rm->msg, rm->msg_len, rm->msg_time);
+			}
+			rm->status=0;
+			rm->msg_len=0;
+			return;
+		}
+		rm->msg[0]=b;
+		rm->msg_len=1;
+		rm->msg_time=time;
+		if (b<SYSTEM_EXCLUSIVE) {
+			rm->status=b;
+			rm->expected=(b>=0xC0 && b<0xE0) ? 2 : 3;
+		} else if (b==SYSTEM_EXCLUSIVE) {
+			rm->status=b;
+			rm->expected=0;
+		} else {
+			//System common messages cancel running status
+			rm->status=0;
+			if (b==0xF1 || b==0xF3) rm->expected=2;
+			else if (b==0xF2) rm->expected=3;
+			else {
+				if (b==0xF6) zmip_rawmidi_write(rm, &b, 1, time);
+				rm->msg_len=0;
+			}
+		}
+		return;
+	}
+	//Data byte
+	if (rm->msg_len==0) {
+		if (rm->status==0 || rm->status==SYSTEM_EXCLUSIVE) return;
+		rm->msg[0]=rm->status;
+		rm->msg_len=1;
+		rm->msg_time=time;
+	}
+	if (rm->status==SYSTEM_EXCLUSIVE) {
+		if (rm->msg_len<ZMIP_RAWMIDI_SYSEX_SIZE) {
+			rm->msg[rm->msg_len++]=b;
+		} else {
+			//Too long => drop it
+			fprintf(stderr, "ZynMidiRouter: SysEx message too long in raw MIDI input '%s'\n", rm->device);
+			rm->status=0;
+			rm->msg_len=0;
+		}
+		return;
+	}
+	rm->msg[rm->msg_len++]=b;
+	if (rm->msg_len>=rm->expected) {
+		zmip_rawmidi_write(rm, rm->msg, rm->msg_len, rm->msg_time);
+		rm->msg_len=0;
+	}
+}
+
+void *zmip_rawmidi_thread(void *arg) {
+	struct zmip_rawmidi_st *rm=(struct zmip_rawmidi_st *)arg;
+	struct pollfd pfds[ZMIP_RAWMIDI_MAX_PFDS];
+	uint8_t buffer[256];
+	int i, n_pfds=1;
+	ssize_t n;
+
+	if (rm->fd>=0) {
+		pfds[0].fd=rm->fd;
+		pfds[0].events=POLLIN;
+	}
+#ifdef HAVE_ALSA_RAWMIDI
+	else {
+		n_pfds=snd_rawmidi_poll_descriptors(rm->handle, pfds, ZMIP_RAWMIDI_MAX_PFDS);
+	}
+#endif
+
+	while (atomic_load_explicit(&rm->running, memory_order_relaxed)) {
+		if (poll(pfds, n_pfds, 100)<=0) continue;
+		//All bytes read at once get the same time
+		jack_nframes_t time=ring_event_time();
+		if (rm->fd>=0) {
+			if (pfds[0].revents & (POLLERR | POLLNVAL)) {
+				fprintf(stderr, "ZynMidiRouter: Error polling raw MIDI input '%s'\n", rm->device);
+				break;
+			}
+			n=read(rm->fd, buffer, sizeof(buffer));
+			//No writer on the pipe => wait for one
+			if (n==0) {
+				usleep(10000);
+				continue;
+			}
+			if (n<0 && errno!=EAGAIN && errno!=EINTR) {
+				fprintf(stderr, "ZynMidiRouter: Error reading raw MIDI input '%s': %s\n", rm->device, strerror(errno));
+				break;
+			}
+		}
+#ifdef HAVE_ALSA_RAWMIDI
+		else {
+			unsigned short revents=0;
+			snd_rawmidi_poll_descriptors_revents(rm->handle, pfds, n_pfds, &revents);
+			//Device unplugged
+			if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+				fprintf(stderr, "ZynMidiRouter: Raw MIDI input '%s' was disconnected\n", rm->device);
+				break;
+			}
+			if (!(revents & POLLIN)) continue;
+			n=snd_rawmidi_read(rm->handle, buffer, sizeof(buffer));
+			if (n<0 && n!=-EAGAIN) {
+				fprintf(stderr, "ZynMidiRouter: Error reading raw MIDI input '%s': %s\n", rm->device, snd_strerror(n));
+				break;
+			}
+		}
+#endif
+		for (i=0;i<n;i++) zmip_rawmidi_parse(rm, buffer[i], time);
+	}
+	//Stopped by error => Drop the input from the RT thread, so the zmip doesn't report it
+	//anymore. The thread & device are released by zmip_close_rawmidi.
+	if (atomic_load_explicit(&rm->running, memory_order_relaxed)) {
+		atomic_store_explicit(&rm->active, 0, memory_order_release);
+		set_ports_changed();
+	}
+	return NULL;
+}
+
+//Device is an ALSA rawmidi device name (i.e. "hw:1,0,0") or the path of a pipe / FIFO
+int zmip_open_rawmidi(int iz, const char *device) {
+	if (iz<0 || iz>=MAX_NUM_ZMIPS || zmips[iz].jport==NULL) {
+		fprintf(stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
 		return 0;
 	}
-	jack_ring_ui_buffer = jack_ringbuffer_create(JACK_MIDI_BUFFER_SIZE);
-	// lock the buffer into memory, this is *NOT* realtime safe, do it before using the buffer!
-	if (jack_ringbuffer_mlock(jack_ring_ui_buffer)) {
-		fprintf(stderr, "ZynMidiRouter: Error locking memory for UI ring-buffer.\n");
+	if (device==NULL || device[0]==0) {
+		fprintf(stderr, "ZynMidiRouter: No raw MIDI device for input port (%d).\n", iz);
 		return 0;
 	}
-	jack_ring_ctrlfb_buffer = jack_ringbuffer_create(JACK_MIDI_BUFFER_SIZE);
-	// lock the buffer into memory, this is *NOT* realtime safe, do it before using the buffer!
-	if (jack_ringbuffer_mlock(jack_ring_ctrlfb_buffer)) {
-		fprintf(stderr, "ZynMidiRouter: Error locking memory for controller feedback ring-buffer.\n");
+	//Also releases a reader thread stopped by error
+	zmip_close_rawmidi(iz);
+
+	struct zmip_rawmidi_st *rm=atomic_load(&zmip_rawmidi[iz]);
+	if (rm==NULL) {
+		rm=(struct zmip_rawmidi_st *)calloc(1, sizeof(struct zmip_rawmidi_st));
+		if (rm==NULL) return 0;
+		rm->iz=iz;
+		rm->ring=jack_ringbuffer_create(ZMIP_RAWMIDI_RING_SIZE);
+		if (rm->ring==NULL || jack_ringbuffer_mlock(rm->ring)) {
+			fprintf(stderr, "ZynMidiRouter: Error creating raw MIDI ring-buffer.\n");
+			if (rm->ring) jack_ringbuffer_free(rm->ring);
+			free(rm);
+			return 0;
+		}
+		atomic_store(&zmip_rawmidi[iz], rm);
+	}
+
+	strncpy(rm->device, device, sizeof(rm->device)-1);
+	rm->device[sizeof(rm->device)-1]=0;
+	rm->status=0;
+	rm->msg_len=0;
+	rm->fd=-1;
+	if (device[0]=='/') {
+		//Read-write, so the FIFO doesn't hang up when the writer closes
+		rm->fd=open(device, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (rm->fd<0) rm->fd=open(device, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (rm->fd<0) {
+			fprintf(stderr, "ZynMidiRouter: Can't open raw MIDI input '%s': %s\n", device, strerror(errno));
+			return 0;
+		}
+	} else {
+#ifdef HAVE_ALSA_RAWMIDI
+		int err=snd_rawmidi_open(&rm->handle, NULL, device, SND_RAWMIDI_NONBLOCK);
+		if (err<0) {
+			fprintf(stderr, "ZynMidiRouter: Can't open raw MIDI input '%s': %s\n", device, snd_strerror(err));
+			rm->handle=NULL;
+			return 0;
+		}
+#else
+		fprintf(stderr, "ZynMidiRouter: Can't open raw MIDI input '%s': built without ALSA support\n", device);
 		return 0;
+#endif
 	}
 
-	//Init Jack Process
-	jack_set_process_callback(jack_client, jack_process, 0);
-	if (jack_activate(jack_client)) {
-		fprintf(stderr, "ZynMidiRouter: Error activating jack client.\n");
+	atomic_store(&rm->running, 1);
+	if (pthread_create(&rm->thread, NULL, zmip_rawmidi_thread, rm)!=0) {
+		fprintf(stderr, "ZynMidiRouter: Error creating raw MIDI reader thread\n");
+		atomic_store(&rm->running, 0);
+		zmip_rawmidi_close_device(rm);
 		return 0;
 	}
+	atomic_store_explicit(&rm->active, 1, memory_order_release);
+	set_ports_changed();
+	return 1;
+}
+
+void zmip_rawmidi_close_device(struct zmip_rawmidi_st *rm) {
+	if (rm->fd>=0) {
+		close(rm->fd);
+		rm->fd=-1;
+	}
+#ifdef HAVE_ALSA_RAWMIDI
+	if (rm->handle) {
+		snd_rawmidi_close(rm->handle);
+		rm->handle=NULL;
+	}
+#endif
+}
 
+int zmip_close_rawmidi(int iz) {
+	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
+		fprintf(stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
+		return 0;
+	}
+	struct zmip_rawmidi_st *rm=atomic_load(&zmip_rawmidi[iz]);
+	if (rm==NULL || !atomic_load(&rm->running)) return 0;
+	atomic_store(&rm->running, 0);
+	pthread_join(rm->thread, NULL);
+	//Pending records are discarded by the RT thread
+	atomic_store_explicit(&rm->active, 0, memory_order_release);
+	zmip_rawmidi_close_device(rm);
+	set_ports_changed();
 	return 1;
 }
 
-int end_jack_midi() {
-	if (jack_client_close(jack_client)) {
-		fprintf(stderr, "ZynMidiRouter: Error closing jack client.\n");
+int zmip_has_rawmidi(int iz) {
+	if (iz<0 || iz>=MAX_NUM_ZMIPS) return 0;
+	struct zmip_rawmidi_st *rm=atomic_load(&zmip_rawmidi[iz]);
+	return rm && atomic_load(&rm->active);
+}
+
+//Called by the RT thread => Read this cycle's events from the zmip's raw MIDI input, if any
+struct zmip_rawmidi_st *zmip_rawmidi_read_events(int iz) {
+	struct zmip_rawmidi_st *rm=atomic_load_explicit(&zmip_rawmidi[iz], memory_order_acquire);
+	if (rm==NULL) return NULL;
+	rm->n_events=0;
+	rm->event_i=0;
+	if (!atomic_load_explicit(&rm->active, memory_order_acquire)) {
+		release_ring_events(rm->ring, &rm->consumed);
+		jack_ringbuffer_read_advance(rm->ring, jack_ringbuffer_read_space(rm->ring));
+		return NULL;
 	}
+	int n_lost;
+	rm->n_events=read_ring_events(rm->ring, &rm->consumed, rm->events, ZMIP_RAWMIDI_MAX_EVENTS, &n_lost);
+	zynmidirouter_rt_stats.zmips[iz].n_dropped+=n_lost;
+	return rm;
+}
+
+//Called by the RT thread => Next input event from the port buffer or the raw MIDI input, in time order
+int zmip_next_input_event(void *port_buffer, int *i, struct zmip_rawmidi_st *rm, jack_midi_event_t *ev) {
+	int res=zynmidi_backend->event_get(ev, port_buffer, *i);
+	if (rm && rm->event_i<rm->n_events && (res!=0 || rm->events[rm->event_i].time<ev->time)) {
+		*ev=rm->events[rm->event_i++];
+		return 1;
+	}
+	if (res!=0) return 0;
+	(*i)++;
 	return 1;
 }
 
+//Called by the RT thread => Release raw MIDI records after the zmops are processed
+void release_zmip_rawmidi_events() {
+	int i;
+	for (i=0;i<n_active_zmips;i++) {
+		struct zmip_rawmidi_st *rm=atomic_load_explicit(&zmip_rawmidi[active_zmips[i]], memory_order_acquire);
+		if (rm) release_ring_events(rm->ring, &rm->consumed);
+	}
+}
+
 
 //-----------------------------------------------------
 // Process ZynMidi Input Port (zmip)
 // forwarding the output to several zmops
 //-----------------------------------------------------
 
-int current_midi_filter_active_chan;
-uint8_t event_buffer_data[JACK_MIDI_BUFFER_SIZE];
+
+//Called by the RT thread => Send sustain pedal to a channel, ahead of the current zmip event
+int zmip_push_sustain(int iz, uint8_t chan, uint8_t val, jack_nframes_t time) {
+	uint8_t *data=event_arena_alloc(3);
+	if (data==NULL) return 0;
+	data[0]=(CTRL_CHANGE << 4) | chan;
+	data[1]=64;
+	data[2]=val;
+	if (!zmip_push_event_data(iz, data, 3, time)) return 0;
+	set_sustain_state(chan, val);
+	return 1;
+}
 
 int jack_process_zmip(int iz, jack_nframes_t nframes) {
 	if (iz<0 || iz>=MAX_NUM_ZMIPS) {
 		fprintf(stderr, "ZynMidiRouter: Bad input port index (%d).\n", iz);
 	}
 	struct zmip_st *zmip=zmips+iz;
+	midi_filter_conf_t *mfc=midi_filter_rt_conf;
 
-	if (zmips[iz].jport==NULL) return 0;
+	//Read once => A destroyed port is released after the RT thread drops it
+	jack_port_t *jport=load_zm_jport(&zmip->jport);
+	if (jport==NULL) return 0;
+	if (!zmip_open_events(iz)) return 0;
 
 	int i=0;
 	int j;
@@ -1064,9 +2730,12 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 	uint8_t event_num;
 	uint8_t event_val;
 	uint32_t ui_event;
+	uint8_t ui_event_flags;
+	uint8_t ui_event_data[ZYNMIDI_EVENT_DATA_SIZE+1];
+	size_t ui_event_size;
 
 	//Read jackd data buffer
-	void *input_port_buffer = jack_port_get_buffer(zmip->jport, nframes);
+	void *input_port_buffer = zynmidi_backend->port_get_buffer(jport, nframes);
 	if (input_port_buffer==NULL) {
 		fprintf(stderr, "ZynMidiRouter: Error getting jack input port buffer: %d frames\n", nframes);
 		return -1;
@@ -1075,18 +2744,30 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 	//Process MIDI messages
 
 	jack_midi_event_t ev;
-	int clone_from_chan=-1;
-	int clone_to_chan=-1;
-	uint8_t *ebd_pointer=event_buffer_data;
+	mf_clone_fanout_t *clone_fanout=NULL;
+	int clone_i=0;
+
+	//Statistics => counted where each event is cloned, discarded or lost
+	zmip_stats_t *zst=zynmidirouter_rt_stats.zmips+iz;
+	uint32_t n_in=0, n_cloned=0, n_filtered=0, n_dropped=0;
+
+	//Raw MIDI input events are merged with the port events
+	struct zmip_rawmidi_st *rawmidi=zmip_rawmidi_read_events(iz);
 
 	while (1) {
 
 		//Clone from last event ...
-		if (clone_from_chan>=0 && clone_to_chan>=0 && clone_to_chan<16) {
-			memcpy(ebd_pointer, ev.buffer, ev.size);
-			ev.buffer=ebd_pointer;
-			ebd_pointer+=ev.size;
-			event_chan=clone_to_chan;
+		if (clone_fanout && clone_i<clone_fanout->n_chans) {
+			uint8_t *clone_data=event_arena_alloc(ev.size);
+			//Arena is full => drop remaining clones of this event
+			if (clone_data==NULL) {
+				clone_fanout=NULL;
+				n_dropped++;
+				continue;
+			}
+			memcpy(clone_data, ev.buffer, ev.size);
+			ev.buffer=clone_data;
+			event_chan=clone_fanout->chans[clone_i];
 			ev.buffer[0]=(ev.buffer[0] & 0xF0) | event_chan;
 
 			event_type=ev.buffer[0] >> 4;
@@ -1112,21 +2793,29 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 				event_num=event_val=0;
 			}
 
-			//loggin.debug("CLONING EVENT %d => %d [0x%x, %d]\n", clone_from_chan, clone_to_chan, event_type, event_num);
+			//loggin.debug("CLONING EVENT => %d [0x%x, %d]\n", event_chan, event_type, event_num);
 
-			clone_to_chan++;
+			clone_i++;
+			n_cloned++;
 		}
 		//Or get next event ...
 		else {
-			if (jack_midi_event_get(&ev, input_port_buffer, i++)!=0) break;
+			if (!zmip_next_input_event(input_port_buffer, &i, rawmidi, &ev)) break;
+			n_in++;
 
 			//Ignore Active Sense & SysEx messages => Is it OK?
-			if (ev.buffer[0]==ACTIVE_SENSE || ev.buffer[0]==SYSTEM_EXCLUSIVE) continue;
+			if (ev.buffer[0]==ACTIVE_SENSE || ev.buffer[0]==SYSTEM_EXCLUSIVE) {
+				n_filtered++;
+				continue;
+			}
 
 			//Get event type & chan
 			if (ev.buffer[0]>=SYSTEM_EXCLUSIVE) {
 				//Ignore System Events depending on flag
-				if (!midi_filter.system_events) continue;
+				if (!mfc->system_events) {
+					n_filtered++;
+					continue;
+				}
 				event_type=ev.buffer[0];
 				event_chan=0;
 			}
@@ -1156,36 +2845,38 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 				event_num=event_val=0;
 			}
 
-			if (ev.buffer[0]<SYSTEM_EXCLUSIVE && event_chan!=midi_filter.master_chan) {
+			if (ev.buffer[0]<SYSTEM_EXCLUSIVE && event_chan!=mfc->master_chan) {
 				//Active Channel => When set, move all channel events to active_chan
-				if ((zmip->flags & FLAG_ZMIP_ACTIVE_CHAN) && current_midi_filter_active_chan>=0) {
-					int destiny_chan=current_midi_filter_active_chan;
-
-					if (midi_filter.last_active_chan>=0) { 
-						// Release pressed notes across active channel changes, excluding cloned channels
-						if (event_type==NOTE_OFF || (event_type==NOTE_ON && event_val==0)) {
-							for (j=0; j<16; j++) {
-								if (j!=destiny_chan && midi_filter.note_state[j][event_num]>0 && !midi_filter.clone[destiny_chan][j].enabled) {
-									destiny_chan=j;
-									//internal_send_note_off(j, event_num, event_val);
-								}
-							}
+				if ((zmip->flags & FLAG_ZMIP_ACTIVE_CHAN) && mfc->active_chan>=0) {
+					int destiny_chan=mfc->active_chan;
+
+					// Release notes on the channel they were sent to, across active channel changes
+					if (event_type==NOTE_OFF || (event_type==NOTE_ON && event_val==0)) {
+						if (zmip_note_owner[iz][event_num]) {
+							destiny_chan=zmip_note_owner[iz][event_num]-1;
+							zmip_note_owner[iz][event_num]=0;
 						}
+					}
+					else if (event_type==NOTE_ON) {
+						zmip_note_owner[iz][event_num]=destiny_chan+1;
+					}
+
+					if (mfc->last_active_chan>=0) {
+						uint16_t sustain_mask=atomic_load_explicit(&sustain_chans_mask, memory_order_relaxed) & ~(1<<destiny_chan);
 						// Manage sustain pedal across active_channel changes, excluding cloned channels
-						else if (event_type==CTRL_CHANGE && event_num==64) {
-							for (j=0; j<16; j++) {
-								if (j!=destiny_chan && midi_filter.last_ctrl_val[j][64]>0 && !midi_filter.clone[destiny_chan][j].enabled) {
-									internal_send_ccontrol_change(j, 64, event_val);
-								}
+						if (event_type==CTRL_CHANGE && event_num==64) {
+							sustain_mask&=~mfc->clone_fanout[destiny_chan].chans_mask;
+							for (j=0; sustain_mask; j++, sustain_mask>>=1) {
+								if (sustain_mask & 1) zmip_push_sustain(iz, j, event_val, ev.time);
 							}
 						}
 						// Re-send sustain pedal on new active_channel if it was pressed before change
-						else if (event_type==NOTE_ON && event_val>0) {
-							for (j=0; j<16; j++) {
-								if (j!=destiny_chan && midi_filter.last_ctrl_val[j][64]>midi_filter.last_ctrl_val[destiny_chan][64]) {
-									internal_send_ccontrol_change(destiny_chan, 64, midi_filter.last_ctrl_val[j][64]);
-								}
+						else if (event_type==NOTE_ON && event_val>0 && sustain_mask) {
+							uint8_t sustain_val=0;
+							for (j=0; sustain_mask; j++, sustain_mask>>=1) {
+								if ((sustain_mask & 1) && midi_filter.last_ctrl_val[j][64]>sustain_val) sustain_val=midi_filter.last_ctrl_val[j][64];
 							}
+							if (sustain_val>midi_filter.last_ctrl_val[destiny_chan][64]) zmip_push_sustain(iz, destiny_chan, sustain_val, ev.time);
 						}
 					}
 					ev.buffer[0]=(ev.buffer[0] & 0xF0) | (destiny_chan & 0x0F);
@@ -1194,22 +2885,21 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 			}
 			
 			//Is it a clonable event?
-			if ((zmip->flags & FLAG_ZMIP_CLONE) && (event_type==NOTE_OFF || event_type==NOTE_ON || event_type==PITCH_BENDING || event_type==KEY_PRESS || event_type==CHAN_PRESS || event_type==CTRL_CHANGE)) {
-				clone_from_chan=event_chan;
-				clone_to_chan=0;
+			if ((zmip->flags & FLAG_ZMIP_CLONE) && mfc->clone_fanout[event_chan].n_chans>0 && (event_type==NOTE_OFF || event_type==NOTE_ON || event_type==PITCH_BENDING || event_type==KEY_PRESS || event_type==CHAN_PRESS || event_type==CTRL_CHANGE)) {
+				clone_fanout=&mfc->clone_fanout[event_chan];
+				clone_i=0;
 			}
 			else {
-				clone_from_chan=-1;
-				clone_to_chan=-1;
+				clone_fanout=NULL;
 			}
 		}
 
-		//Check for next clone_to channel ...
-		if (clone_from_chan>=0 && clone_to_chan>=0) {
-			while (clone_to_chan<16 && (!midi_filter.clone[clone_from_chan][clone_to_chan].enabled || (event_type==CTRL_CHANGE && !midi_filter.clone[clone_from_chan][clone_to_chan].cc[event_num]))) {
-				clone_to_chan++;
+		//Check for next clone_to channel => CC events are cloned only to targets having the CC in their mask
+		if (clone_fanout && event_type==CTRL_CHANGE) {
+			while (clone_i<clone_fanout->n_chans && !MASK128_TEST(clone_fanout->cc_mask[clone_i], event_num)) {
+				clone_i++;
 			}
-			//fprintf(stderr, "NEXT EVENT CLONE  %d => %d [0x%x, %d]\n", clone_from_chan, clone_to_chan, event_type, event_num);
+			//fprintf(stderr, "NEXT EVENT CLONE => %d [0x%x, %d]\n", clone_i, event_type, event_num);
 		}
 
 		//if (ev.buffer[0]!=0xfe)
@@ -1219,18 +2909,23 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 		ui_event=0;
 		if ((zmip->flags & FLAG_ZMIP_UI) && midi_learning_mode && (event_type==CTRL_CHANGE || event_type==NOTE_ON || event_type==NOTE_OFF)) {
 			ui_event=(ev.buffer[0]<<16)|(ev.buffer[1]<<8)|(ev.buffer[2]);
+			//Keep the unfiltered message for the wide UI record
+			ui_event_size=ev.size;
+			memcpy(ui_event_data, ev.buffer, ev.size>sizeof(ui_event_data) ? sizeof(ui_event_data) : ev.size);
+			ui_event_flags=FLAG_ZYNMIDI_LEARN;
 		}
 
 		//Event Mapping
 		if ((zmip->flags & FLAG_ZMIP_FILTER) && event_type>=NOTE_OFF && event_type<=PITCH_BENDING) {
-			midi_event_t *event_map=&midi_filter.event_map[event_type & 0x7][event_chan][event_num];
+			midi_event_t *event_map=lookup_midi_filter_map(mfc, event_type & 0x7, event_chan, event_num);
 			//Ignore event...
-			if (event_map->type==IGNORE_EVENT) {
+			if (event_map && event_map->type==IGNORE_EVENT) {
 				//fprintf(stdout, "IGNORE => %x, %x, %x\n",event_type, event_chan, event_num);
+				n_filtered++;
 				continue;
 			}
 			//Map event ...
-			if (event_map->type>=0) {
+			if (event_map && event_map->type>=0) {
 				//fprintf(stdout, "ZynMidiRouter: Event Map %x, %x => ",ev.buffer[0],ev.buffer[1]);
 				event_type=event_map->type;
 				event_chan=event_map->chan;
@@ -1250,18 +2945,22 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 					ev.buffer[2]=event_val;
 					ev.size=3;
 				}
+				zst->n_mapped++;
 				//fprintf(stdout, "MIDI MSG => %x, %x\n",ev.buffer[0],ev.buffer[1]);
 			}
 		}
 
 		//Capture events for UI: MASTER CHANNEL + Program Change
 		if (zmip->flags & FLAG_ZMIP_UI) {
-			if (event_chan==midi_filter.master_chan) {
+			if (event_chan==mfc->master_chan) {
 				write_zynmidi((ev.buffer[0]<<16)|(ev.buffer[1]<<8)|(ev.buffer[2]));
+				write_zynmidi_event(iz, ev.time, ev.buffer, ev.size, FLAG_ZYNMIDI_MASTER);
+				n_filtered++;
 				continue;
 			}
 			if (event_type==PROG_CHANGE) {
 				write_zynmidi((ev.buffer[0]<<16)|(ev.buffer[1]<<8)|(ev.buffer[2]));
+				write_zynmidi_event(iz, ev.time, ev.buffer, ev.size, 0);
 			}
 		}
 
@@ -1279,6 +2978,7 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 				else if (event_val==64) {
 					if (midi_filter.ctrl_relmode_count[event_chan][event_num]==1) {
 						midi_filter.ctrl_relmode_count[event_chan][event_num]=0;
+						n_filtered++;
 						continue;
 					} else {
 						midi_filter.ctrl_mode[event_chan][event_num]=0;
@@ -1297,7 +2997,7 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 			}
 
 			//Absolut Mode
-			if (midi_filter.ctrl_mode[event_chan][event_num]==0 && midi_filter.cc_automode==1) {
+			if (midi_filter.ctrl_mode[event_chan][event_num]==0 && mfc->cc_automode==1) {
 				if (event_val==64) {
 					//printf("Tenting Relative Mode ...\n");
 					midi_filter.ctrl_mode[event_chan][event_num]=1;
@@ -1305,12 +3005,16 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 					// Here we lost a tick when an absolut knob moves fast and touch val=64,
 					// but if we want auto-detect rel-mode and change softly to it, it's the only way.
 					int16_t last_val=midi_filter.last_ctrl_val[event_chan][event_num];
-					if (abs(last_val-event_val)>4) continue;
+					if (abs(last_val-event_val)>4) {
+						n_filtered++;
+						continue;
+					}
 				}
 			}
 
 			//Save last controller value ...
-			midi_filter.last_ctrl_val[event_chan][event_num]=event_val;
+			if (event_num==64) set_sustain_state(event_chan, event_val);
+			else midi_filter.last_ctrl_val[event_chan][event_num]=event_val;
 
 			//Ignore Bank Change events when FLAG_ZMIP_UI
 			//if ((zmip->flags & FLAG_ZMIP_UI) && (event_num==0 || event_num==32)) {
@@ -1323,38 +3027,48 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 			int discard_note=0;
 			int note=ev.buffer[1];
 			//Note-range
-			if (note<midi_filter.noterange[event_chan].note_low || note>midi_filter.noterange[event_chan].note_high) discard_note=1;
+			if (note<mfc->noterange[event_chan].note_low || note>mfc->noterange[event_chan].note_high) discard_note=1;
 			//Transpose
 			if (!discard_note) {
-				note+=12*midi_filter.noterange[event_chan].octave_trans;
-				note+=midi_filter.noterange[event_chan].halftone_trans;
+				note+=12*mfc->noterange[event_chan].octave_trans;
+				note+=mfc->noterange[event_chan].halftone_trans;
 				//If result note is out of range, ignore it ...
 				if (note>0x7F || note<0) discard_note=1;
 				else event_num=ev.buffer[1]=(uint8_t)(note & 0x7F);
 			}
 			if (discard_note) {
 				//If already captured, forward event to UI
-				if (ui_event) write_zynmidi(ui_event);
+				if (ui_event) {
+					write_zynmidi(ui_event);
+					write_zynmidi_event(iz, ev.time, ui_event_data, ui_event_size, ui_event_flags);
+				}
+				n_filtered++;
 				continue;
 			}
 		}
 
 		//Save note state ...
-		if (event_type==NOTE_ON) midi_filter.note_state[event_chan][event_num]=event_val;
-		else if (event_type==NOTE_OFF) midi_filter.note_state[event_chan][event_num]=0;
+		if (event_type==NOTE_ON) set_note_state(event_chan, event_num, event_val);
+		else if (event_type==NOTE_OFF) set_note_state(event_chan, event_num, 0);
 
 		//Capture events for UI: after filtering => [Note-Off, Note-On, Control-Change, SysEx]
 		if (!ui_event && (zmip->flags & FLAG_ZMIP_UI) && (event_type==NOTE_OFF || event_type==NOTE_ON || event_type==CTRL_CHANGE || event_type==PITCH_BENDING || event_type>=SYSTEM_EXCLUSIVE)) {
 			ui_event=(ev.buffer[0]<<16)|(ev.buffer[1]<<8)|(ev.buffer[2]);
+			ui_event_size=ev.size;
+			memcpy(ui_event_data, ev.buffer, ev.size>sizeof(ui_event_data) ? sizeof(ui_event_data) : ev.size);
+			ui_event_flags=0;
 		}
 
 		//Forward event to UI
-		if (ui_event) write_zynmidi(ui_event);
+		if (ui_event) {
+			write_zynmidi(ui_event);
+			write_zynmidi_event(iz, ev.time, ui_event_data, ui_event_size, ui_event_flags);
+		}
 
 		//Swap Mapping
 		//fprintf(stderr, "PRESWAP MIDI EVENT: %d, %d, %d\n", ev.buffer[0], ev.buffer[1], ev.buffer[2]);
-		if ((zmip->flags & FLAG_ZMIP_FILTER) && event_type==CTRL_CHANGE) {
-			midi_event_t *cc_swap=&midi_filter.cc_swap[event_chan][event_num];
+		midi_event_t *cc_swap;
+		if ((zmip->flags & FLAG_ZMIP_FILTER) && event_type==CTRL_CHANGE && (cc_swap=lookup_midi_filter_map(mfc, MF_MAP_CC_SWAP, event_chan, event_num))) {
 			//fprintf(stdout, "ZynMidiRouter: CC Swap %x, %x => ",ev.buffer[0],ev.buffer[1]);
 			event_chan=cc_swap->chan;
 			event_num=cc_swap->num;
@@ -1362,6 +3076,7 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 			ev.buffer[1]=event_num;
 			ev.buffer[2]=event_val;
 			ev.size=3;
+			zst->n_mapped++;
 			//fprintf(stdout, "MIDI MSG => %x, %x\n",ev.buffer[0],ev.buffer[1]);
 		}
 		//fprintf(stderr, "POSTSWAP MIDI EVENT: %d, %d, %d\n", ev.buffer[0], ev.buffer[1], ev.buffer[2]);
@@ -1371,9 +3086,14 @@ int jack_process_zmip(int iz, jack_nframes_t nframes) {
 			midi_event_zynpot(event_chan, event_num, event_val);
 		}
 
-
-		zmip_push_event(iz, &ev);
+		if (!zmip_push_event(iz, &ev)) n_dropped++;
 	}
+
+	zst->n_in+=n_in;
+	zst->n_cloned+=n_cloned;
+	zst->n_dropped+=n_dropped;
+	zst->n_filtered+=n_filtered;
+	if (n_in>zst->peak_in) zst->peak_in=n_in;
 	return 0;
 }
 
@@ -1386,6 +3106,7 @@ int jack_process_zmop(int iz, jack_nframes_t nframes) {
 		fprintf(stderr, "ZynMidiRouter: Bad output port index (%d).\n", iz);
 	}
 	struct zmop_st *zmop=zmops+iz;
+	midi_filter_conf_t *mfc=midi_filter_rt_conf;
 
 	int i=0;
 	int izmip=-1;
@@ -1393,23 +3114,34 @@ int jack_process_zmop(int iz, jack_nframes_t nframes) {
 	uint8_t event_type;
 	uint8_t event_chan;
 
+	//Channel messages are rewritten into a local copy, as events are shared by all zmops
+	jack_midi_data_t *ev_data;
+	jack_midi_data_t ch_buffer[3];
+
 	//Fine-tunning event
 	jack_midi_event_t xev;
 	jack_midi_data_t xev_buffer[3];
 	xev.buffer=(jack_midi_data_t *)&xev_buffer;
 
 	//Get MIDI jack data buffer and clear it
-	void *output_port_buffer = jack_port_get_buffer(zmop->jport, nframes);
+	jack_port_t *jport=load_zm_jport(&zmop->jport);
+	if (jport==NULL) return 0;
+	void *output_port_buffer = zynmidi_backend->port_get_buffer(jport, nframes);
 	if (output_port_buffer==NULL) {
 		fprintf(stderr, "ZynMidiRouter: Error getting jack output port buffer: %d frames\n", nframes);
 		return -1;
 	}
-	jack_midi_clear_buffer(output_port_buffer);
+	zynmidi_backend->clear_buffer(output_port_buffer);
 
 	//fprintf(stderr, "ZynMidiRouter: Processing ZMOP %d\n",iz);
 
-	//Write MIDI data
-	//TODO: Avoid frame overflow by checking that num_zmop_events<nframes => implement ring buffer in zmop??
+	//Statistics => spill counters are accumulated by the spill queue
+	zmop_stats_t *zst=zynmidirouter_rt_stats.zmops+iz;
+	uint32_t n_spilled=zmop->spill.n_spilled;
+	uint32_t n_dropped=zmop->spill.n_dropped;
+
+	//Write events spilled from previous cycles
+	i=zmop_flush_spill(iz, output_port_buffer);
 
 	zmop_reset_event_counters(iz);
 
@@ -1418,15 +3150,14 @@ int jack_process_zmop(int iz, jack_nframes_t nframes) {
 
 		//fprintf(stderr, "\nZynMidiRouter: Processing Event of type %d\n",event_type);
 
-		//Channel filter & translation
+		//Channel translation => Channel filter is already applied by the event's zmop_mask
+		ev_data = ev->buffer;
 		if (event_type>=NOTE_OFF && event_type<=PITCH_BENDING) {
-			event_chan = ev->buffer[0] & 0x0F;
-			if (zmop->midi_chans[event_chan]<0) {
-				continue;
-			} else {
-				event_chan = zmop->midi_chans[event_chan] & 0x0F;
-				ev->buffer[0] = (ev->buffer[0] & 0xF0) | event_chan;
-			}
+			event_chan = mfc->zmop_chans_trans[iz][ev->buffer[0] & 0x0F];
+			ch_buffer[0] = (ev->buffer[0] & 0xF0) | event_chan;
+			ch_buffer[1] = ev->size>1 ? ev->buffer[1] : 0;
+			ch_buffer[2] = ev->size>2 ? ev->buffer[2] : 0;
+			ev_data = ch_buffer;
 		}
 
 		//Drop "Program Change" from engine zmops
@@ -1436,10 +3167,10 @@ int jack_process_zmop(int iz, jack_nframes_t nframes) {
 		
 		// Fine-Tuning, using pitch-bending messages ...
 		xev.size=0;
-		if ((zmop->flags & FLAG_ZMOP_TUNING) && midi_filter.tuning_pitchbend>=0) {
+		if ((zmop->flags & FLAG_ZMOP_TUNING) && mfc->tuning_pitchbend>=0) {
 			if (event_type==NOTE_ON) {
 				int pb=midi_filter.last_pb_val[event_chan];
-				//printf("NOTE-ON PITCHBEND=%d (%d)\n",pb,midi_filter.tuning_pitchbend);
+				//printf("NOTE-ON PITCHBEND=%d (%d)\n",pb,mfc->tuning_pitchbend);
 				pb=get_tuned_pitchbend(pb);
 				//printf("NOTE-ON TUNED PITCHBEND=%d\n",pb);
 				xev.buffer[0]=(PITCH_BENDING << 4) | event_chan;
@@ -1449,38 +3180,33 @@ int jack_process_zmop(int iz, jack_nframes_t nframes) {
 				xev.time=ev->time;
 			} else if (event_type==PITCH_BENDING) {
 				//Get received PB
-				int pb=(ev->buffer[2] << 7) | ev->buffer[1];
+				int pb=(ev_data[2] << 7) | ev_data[1];
 				//Save last received PB value ...
 				midi_filter.last_pb_val[event_chan]=pb;
 				//Calculate tuned PB
 				//printf("PITCHBEND=%d\n",pb);
 				pb=get_tuned_pitchbend(pb);
 				//printf("TUNED PITCHBEND=%d\n",pb);
-				ev->buffer[1]=pb & 0x7F;
-				ev->buffer[2]=(pb >> 7) & 0x7F;
+				ev_data[1]=pb & 0x7F;
+				ev_data[2]=(pb >> 7) & 0x7F;
 			}
 		}
 		
 		//fprintf(stderr, "ZynMidiRouter: Writing Event %d => %d (CH#%d)\n",ev->time, i, ev->buffer[0] & 0xF);
 
-		//Write to Jackd buffer
-		if (jack_midi_event_write(output_port_buffer, ev->time, ev->buffer, ev->size)!=0) {
-			fprintf(stderr, "ZynMidiRouter: Error writing jack midi output event!\n");
-			continue;
-		}
-		i++;
-
+		//Write to Jackd buffer => Events that don't fit are spilled to next cycle
+		if (zmop_write_event(iz, output_port_buffer, ev->time, ev_data, ev->size)) i++;
 		if (xev.size>0) {
-			if (jack_midi_event_write(output_port_buffer, xev.time, xev.buffer, xev.size)!=0) {
-				fprintf(stderr, "ZynMidiRouter: Error writing jack midi output event!\n");
-				continue;
-			}
-			i++;
+			if (zmop_write_event(iz, output_port_buffer, xev.time, xev.buffer, xev.size)) i++;
 		}
 
 		//fprintf(stderr, "ZynMidiRouter: Processed Event %d\n",i);
 	}
 
+	zst->n_out+=i;
+	zst->n_spilled+=zmop->spill.n_spilled-n_spilled;
+	zst->n_dropped+=zmop->spill.n_dropped-n_dropped;
+	if (i>zst->peak_out) zst->peak_out=i;
 	return 0;
 }
 
@@ -1492,8 +3218,21 @@ int jack_process_zmop(int iz, jack_nframes_t nframes) {
 int jack_process(jack_nframes_t nframes, void *arg) {
 	int i;
 
-	// Get current Active Chan
-	current_midi_filter_active_chan=midi_filter.active_chan;
+	//Stage timing, only when profiling
+	int profiling=atomic_load_explicit(&zynmidirouter_profiling, memory_order_relaxed);
+	uint64_t stage_ns[PROFILE_NUM_STAGES];
+	uint64_t t0=0, t1=0, t2=0;
+	if (profiling) t0=t1=profile_clock_ns();
+
+	// Get current MIDI filter config snapshot
+	acquire_midi_filter_conf();
+
+	// Frame time of this cycle, for mapping ring-buffer event times
+	cycle_frame_time=zynmidi_backend->last_frame_time();
+	cycle_nframes=nframes;
+
+	// Release event data from last cycle
+	reset_event_arena();
 	
 	//---------------------------------
 	// Clear Output Port Data Buffers
@@ -1502,21 +3241,24 @@ int jack_process(jack_nframes_t nframes, void *arg) {
 	//fprintf(stderr, "ZynMidiRouter: ZMIPs events cleaned\n");
 
 	//---------------------------------
-	// Get number of connection of Output Ports
+	// Refresh active ports, if connections changed
 	//---------------------------------
-	for (i=0;i<MAX_NUM_ZMOPS;i++) {
-		zmops[i].n_connections=jack_port_connected(zmops[i].jport);
-	}
+	update_active_ports();
 	//fprintf(stderr, "ZynMidiRouter: Num. of connections refreshed\n");
 
 	//---------------------------------
 	//MIDI Input
 	//---------------------------------
-	for (i=0;i<MAX_NUM_ZMIPS;i++) {
-		if (midi_learning_mode && i==ZMIP_CTRL) continue;
-		if (jack_process_zmip(i, nframes)<0) return -1;
+	for (i=0;i<n_active_zmips;i++) {
+		if (midi_learning_mode && active_zmips[i]==ZMIP_CTRL) continue;
+		if (jack_process_zmip(active_zmips[i], nframes)<0) return -1;
 	}
 	//fprintf(stderr, "ZynMidiRouter: ZMIP processed\n");
+	if (profiling) {
+		t2=profile_clock_ns();
+		stage_ns[PROFILE_STAGE_INPUT]=t2-t1;
+		t1=t2;
+	}
 
 	//---------------------------------
 	//MIDI from Internal functions (zyncoder, etc.)
@@ -1524,6 +3266,11 @@ int jack_process(jack_nframes_t nframes, void *arg) {
 	//Forward internal MIDI data from ringbuffer to all ZMOPS except ZMOP_CTRL
 	if (forward_internal_midi_data()<0) return -1;
 	//fprintf(stderr, "ZynMidiRouter: Internal MIDI forwarded\n");
+	if (profiling) {
+		t2=profile_clock_ns();
+		stage_ns[PROFILE_STAGE_INTERNAL]=t2-t1;
+		t1=t2;
+	}
 
 	//---------------------------------
 	//MIDI from UI
@@ -1531,6 +3278,13 @@ int jack_process(jack_nframes_t nframes, void *arg) {
 	//Forward UI MIDI data from ringbuffer to all ZMOPS except ZMOP_CTRL
 	if (forward_ui_midi_data()<0) return -1;
 	//fprintf(stderr, "ZynMidiRouter: UI MIDI forwarded\n");
+	//Send pending panic note-offs after UI events
+	process_panic(nframes);
+	if (profiling) {
+		t2=profile_clock_ns();
+		stage_ns[PROFILE_STAGE_UI]=t2-t1;
+		t1=t2;
+	}
 
 	//---------------------------------
 	//MIDI Controller Feedback 
@@ -1538,20 +3292,197 @@ int jack_process(jack_nframes_t nframes, void *arg) {
 	//Forward Controller Feedback MIDI data from ringbuffer to ZMOP_CTRL
 	if (forward_ctrlfb_midi_data()<0) return -1;
 	//fprintf(stderr, "ZynMidiRouter: Controller-FeedBack MIDI forwarded\n");
+	if (profiling) {
+		t2=profile_clock_ns();
+		stage_ns[PROFILE_STAGE_CTRLFB]=t2-t1;
+		t1=t2;
+	}
+
+	//---------------------------------
+	//Merge input events into a single timeline
+	//---------------------------------
+	zmips_merge_events();
 
 	//---------------------------------
 	//MIDI Output
 	//---------------------------------
-	for (i=0;i<MAX_NUM_ZMOPS;i++) {
-		if (zmops[i].n_connections>0) {
-			if (jack_process_zmop(i, nframes)<0) return -1;
-		}
+	for (i=0;i<n_active_zmops;i++) {
+		if (jack_process_zmop(active_zmops[i], nframes)<0) return -1;
 	}
+	clear_idle_zmops(nframes);
+
+	//Wake up the UI if events were sent to it in this cycle
+	notify_zynmidi();
+
+	//Release ring-buffer records forwarded in this cycle
+	release_ring_events(jack_ring_internal_buffer, &jack_ring_internal_consumed);
+	release_ring_events(jack_ring_ui_buffer, &jack_ring_ui_consumed);
+	release_ring_events(jack_ring_ctrlfb_buffer, &jack_ring_ctrlfb_consumed);
+	release_zmip_rawmidi_events();
 	//fprintf(stderr, "ZynMidiRouter: ZMOP processed\n");
 
+	publish_zynmidirouter_stats();
+	atomic_fetch_add_explicit(&zynmidi_cycle_count, 1, memory_order_release);
+
+	if (profiling) {
+		t2=profile_clock_ns();
+		stage_ns[PROFILE_STAGE_OUTPUT]=t2-t1;
+		stage_ns[PROFILE_STAGE_CYCLE]=t2-t0;
+		publish_zynmidirouter_profile(stage_ns, nframes);
+	}
+
 	return 0;
 }
 
+//-----------------------------------------------------
+// Ring-buffer Event Records
+//-----------------------------------------------------
+
+int midi_event_latency=-1;
+
+int set_midi_event_latency(int nframes) {
+	midi_event_latency=nframes;
+	return 1;
+}
+
+int get_midi_event_latency() {
+	return midi_event_latency;
+}
+
+//Called by the writers => Current frame time
+jack_nframes_t ring_event_time() {
+	if (zynmidi_backend) return zynmidi_backend->frame_time();
+	else return 0;
+}
+
+//Called by the RT thread => Frame offset in current cycle for an event written at "time"
+jack_nframes_t ring_event_offset(jack_nframes_t time) {
+	if (cycle_nframes==0) return 0;
+	int latency=midi_event_latency;
+	if (latency<0) latency=cycle_nframes;
+	int32_t offset=(int32_t)(time-cycle_frame_time)+latency;
+	if (offset<0) return 0;
+	if (offset>=(int32_t)cycle_nframes) return cycle_nframes-1;
+	return (jack_nframes_t)offset;
+}
+
+//Copy data from/to a ring-buffer vector, at offset "off" from the first segment, across the wrap point
+void ring_vector_read(jack_ringbuffer_data_t *vec, size_t off, uint8_t *dst, size_t n) {
+	if (off<vec[0].len) {
+		size_t n0=vec[0].len-off;
+		if (n0>n) n0=n;
+		memcpy(dst, vec[0].buf+off, n0);
+		memcpy(dst+n0, vec[1].buf, n-n0);
+	} else {
+		memcpy(dst, vec[1].buf+(off-vec[0].len), n);
+	}
+}
+
+void ring_vector_write(jack_ringbuffer_data_t *vec, size_t off, uint8_t *src, size_t n) {
+	if (off<vec[0].len) {
+		size_t n0=vec[0].len-off;
+		if (n0>n) n0=n;
+		memcpy(vec[0].buf+off, src, n0);
+		memcpy(vec[1].buf, src+n0, n-n0);
+	} else {
+		memcpy(vec[1].buf+(off-vec[0].len), src, n);
+	}
+}
+
+//Pointer to n contiguous bytes at offset "off", or NULL if they wrap
+uint8_t *ring_vector_ptr(jack_ringbuffer_data_t *vec, size_t off, size_t n) {
+	if (off+n<=vec[0].len) return (uint8_t *)vec[0].buf+off;
+	if (off>=vec[0].len) return (uint8_t *)vec[1].buf+(off-vec[0].len);
+	return NULL;
+}
+
+//Write a record (header + payload) as a whole, so the reader never sees a partial record
+int write_ring_event(jack_ringbuffer_t *rb, int iz, const char *name, uint8_t *event_buffer, int event_size) {
+	return write_ring_event_time(rb, iz, name, ring_event_time(), event_buffer, event_size);
+}
+
+//Same, with the frame time captured by the writer
+int write_ring_event_time(jack_ringbuffer_t *rb, int iz, const char *name, jack_nframes_t time, uint8_t *event_buffer, int event_size) {
+	if (event_size<1) {
+		fprintf(stderr, "ZynMidiRouter: Error writing %s ring-buffer: BAD SIZE (%d)\n", name, event_size);
+		return 0;
+	}
+	jack_ringbuffer_data_t vec[2];
+	jack_ringbuffer_get_write_vector(rb, vec);
+	if (vec[0].len+vec[1].len<sizeof(ring_event_t)+event_size) {
+		fprintf(stderr, "ZynMidiRouter: Error writing %s ring-buffer: FULL\n", name);
+		count_zmip_ring_dropped(iz);
+		return 0;
+	}
+	ring_event_t rev;
+	rev.time=time;
+	rev.size=event_size;
+	ring_vector_write(vec, 0, (uint8_t *)&rev, sizeof(ring_event_t));
+	ring_vector_write(vec, sizeof(ring_event_t), event_buffer, event_size);
+	jack_ringbuffer_write_advance(rb, sizeof(ring_event_t)+event_size);
+	return 1;
+}
+
+//Called by the RT thread => Parse up to "max_events" records to "events", pointing to the payload in the ring.
+//Records are released on the next call, or by release_ring_events, after the zmops are processed.
+//Events are kept sorted by time. Records lost because the arena is full are counted in "n_lost".
+int read_ring_events(jack_ringbuffer_t *rb, size_t *consumed, jack_midi_event_t *events, int max_events, int *n_lost) {
+	jack_ringbuffer_data_t vec[2];
+	ring_event_t rev;
+	size_t avail, off=0;
+	uint8_t *data;
+	int n=0;
+
+	*n_lost=0;
+	release_ring_events(rb, consumed);
+	jack_ringbuffer_get_read_vector(rb, vec);
+	avail=vec[0].len+vec[1].len;
+	while (avail-off>=sizeof(ring_event_t) && n<max_events) {
+		ring_vector_read(vec, off, (uint8_t *)&rev, sizeof(ring_event_t));
+		if (avail-off-sizeof(ring_event_t)<rev.size) break;
+		off+=sizeof(ring_event_t);
+		data=ring_vector_ptr(vec, off, rev.size);
+		//Payload wraps around the ring end => copy it to the arena
+		if (data==NULL) {
+			data=event_arena_alloc(rev.size);
+			if (data) ring_vector_read(vec, off, data, rev.size);
+		}
+		off+=rev.size;
+		if (data==NULL) {
+			(*n_lost)++;
+			continue;
+		}
+		events[n].buffer=data;
+		events[n].size=rev.size;
+		events[n].time=ring_event_offset(rev.time);
+		if (n>0 && events[n].time<events[n-1].time) events[n].time=events[n-1].time;
+		n++;
+	}
+	*consumed=off;
+	return n;
+}
+
+//Called by the RT thread => Push records to a fake zmip
+int forward_ring_events(jack_ringbuffer_t *rb, size_t *consumed, int iz) {
+	int n_lost;
+	if (!zmip_open_events(iz)) return 0;
+	int n=read_ring_events(rb, consumed, zmips[iz].events+zmips[iz].n_events, zmips[iz].max_events-zmips[iz].n_events, &n_lost);
+	zmips[iz].n_events+=n;
+
+	zmip_stats_t *zst=zynmidirouter_rt_stats.zmips+iz;
+	zst->n_in+=n+n_lost;
+	zst->n_dropped+=n_lost;
+	if (n+n_lost>zst->peak_in) zst->peak_in=n+n_lost;
+	return n;
+}
+
+void release_ring_events(jack_ringbuffer_t *rb, size_t *consumed) {
+	if (*consumed>0) {
+		jack_ringbuffer_read_advance(rb, *consumed);
+		*consumed=0;
+	}
+}
+
 //-----------------------------------------------------
 // MIDI Internal Input <= Internal (zyncoder, etc.)
 //-----------------------------------------------------
@@ -1560,26 +3491,17 @@ int jack_process(jack_nframes_t nframes, void *arg) {
 // Event Ring-Buffer Management
 //------------------------------
 
-uint8_t internal_midi_data[JACK_MIDI_BUFFER_SIZE];
-
 int write_internal_midi_event(uint8_t *event_buffer, int event_size) {
-	if (jack_ringbuffer_write_space(jack_ring_internal_buffer)>=event_size) {
-		if (jack_ringbuffer_write(jack_ring_internal_buffer, event_buffer, event_size)!=event_size) {
-			fprintf(stderr, "ZynMidiRouter: Error writing internal ring-buffer: INCOMPLETE\n");
-			return 0;
-		}
-	}
-	else {
-		fprintf(stderr, "ZynMidiRouter: Error writing internal ring-buffer: FULL\n");
-		return 0;
-	}
+	if (!write_ring_event(jack_ring_internal_buffer, ZMIP_FAKE_INT, "internal", event_buffer, event_size)) return 0;
+	if (event_size<3 || event_buffer[0]>=SYSTEM_EXCLUSIVE) return 1;
 
 	//Set last CC value
 	if (event_buffer[0] & (CTRL_CHANGE<<4)) {
 		uint8_t chan=event_buffer[0] & 0x0F;
 		uint8_t num=event_buffer[1];
 		uint8_t val=event_buffer[2];
-		midi_filter.last_ctrl_val[chan][num]=val;
+		if ((event_buffer[0] & 0xF0)==(CTRL_CHANGE<<4) && num==64) set_sustain_state(chan, val);
+		else midi_filter.last_ctrl_val[chan][num]=val;
 	}
 	//Set note state
 	else if (event_buffer[0] & (NOTE_ON<<4)) {
@@ -1599,17 +3521,9 @@ int write_internal_midi_event(uint8_t *event_buffer, int event_size) {
 
 //Get MIDI data from ringbuffer and forward to all ZMOPS via ZMIP_FAKE_INT
 int forward_internal_midi_data() {
-	int nb=jack_ringbuffer_read_space(jack_ring_internal_buffer);
-	if (jack_ringbuffer_read(jack_ring_internal_buffer, internal_midi_data, nb)!=nb) {
-		fprintf(stderr, "ZynMidiRouter: Error reading midi data from internal ring-buffer: %d bytes\n", nb);
-		return -1;
-	}
-	//TODO: Avoid buffer overflow => check that nb<=(JACK_MIDI_BUFFER_SIZE-n_data)
-	int j;
-	for (j=0;j<nb/3;j++) {
-		zmip_push_event_data(ZMIP_FAKE_INT,internal_midi_data+j*3);
-	}
-	return j;
+	int n=forward_ring_events(jack_ring_internal_buffer, &jack_ring_internal_consumed, ZMIP_FAKE_INT);
+	save_zmip_note_state(ZMIP_FAKE_INT, n);
+	return n;
 }
 
 //------------------------------
@@ -1645,7 +3559,7 @@ int internal_send_program_change(uint8_t chan, uint8_t prgm) {
 	buffer[0] = 0xC0 + (chan & 0x0F);
 	buffer[1] = prgm;
 	buffer[2] = 0;
-	return write_internal_midi_event(buffer,3);
+	return write_internal_midi_event(buffer,2);
 }
 
 int internal_send_chan_press(uint8_t chan, uint8_t val) {
@@ -1653,7 +3567,7 @@ int internal_send_chan_press(uint8_t chan, uint8_t val) {
 	buffer[0] = 0xD0 + (chan & 0x0F);
 	buffer[1] = val;
 	buffer[2] = 0;
-	return write_internal_midi_event(buffer,3);
+	return write_internal_midi_event(buffer,2);
 }
 
 int internal_send_pitchbend_change(uint8_t chan, uint16_t pb) {
@@ -1699,26 +3613,17 @@ int internal_send_all_notes_off_chan(uint8_t chan) {
 // Event Ring-Buffer Management
 //------------------------------
 
-uint8_t ui_midi_data[JACK_MIDI_BUFFER_SIZE];
-
 int write_ui_midi_event(uint8_t *event_buffer, int event_size) {
-	if (jack_ringbuffer_write_space(jack_ring_ui_buffer)>=event_size) {
-		if (jack_ringbuffer_write(jack_ring_ui_buffer, event_buffer, event_size)!=event_size) {
-			fprintf(stderr, "ZynMidiRouter: Error writing UI ring-buffer: INCOMPLETE\n");
-			return 0;
-		}
-	}
-	else {
-		fprintf(stderr, "ZynMidiRouter: Error writing UI ring-buffer: FULL\n");
-		return 0;
-	}
+	if (!write_ring_event(jack_ring_ui_buffer, ZMIP_FAKE_UI, "UI", event_buffer, event_size)) return 0;
+	if (event_size<3 || event_buffer[0]>=SYSTEM_EXCLUSIVE) return 1;
 
 	//Set last CC value
 	if (event_buffer[0] & (CTRL_CHANGE<<4)) {
 		uint8_t chan=event_buffer[0] & 0x0F;
 		uint8_t num=event_buffer[1];
 		uint8_t val=event_buffer[2];
-		midi_filter.last_ctrl_val[chan][num]=val;
+		if ((event_buffer[0] & 0xF0)==(CTRL_CHANGE<<4) && num==64) set_sustain_state(chan, val);
+		else midi_filter.last_ctrl_val[chan][num]=val;
 	}
 	//Set note state
 	else if (event_buffer[0] & (NOTE_ON<<4)) {
@@ -1738,17 +3643,9 @@ int write_ui_midi_event(uint8_t *event_buffer, int event_size) {
 
 //Get MIDI data from ringbuffer and forward to all ZMOPS via ZMIP_FAKE_INT
 int forward_ui_midi_data() {
-	int nb=jack_ringbuffer_read_space(jack_ring_ui_buffer);
-	if (jack_ringbuffer_read(jack_ring_ui_buffer, ui_midi_data, nb)!=nb) {
-		fprintf(stderr, "ZynMidiRouter: Error reading midi data from UI ring-buffer: %d bytes\n", nb);
-		return -1;
-	}
-	//TODO: Avoid buffer overflow => check that nb<=(JACK_MIDI_BUFFER_SIZE-n_data)
-	int j;
-	for (j=0;j<nb/3;j++) {
-		zmip_push_event_data(ZMIP_FAKE_UI,ui_midi_data+j*3);
-	}
-	return j;
+	int n=forward_ring_events(jack_ring_ui_buffer, &jack_ring_ui_consumed, ZMIP_FAKE_UI);
+	save_zmip_note_state(ZMIP_FAKE_UI, n);
+	return n;
 }
 
 //------------------------------
@@ -1784,7 +3681,7 @@ int ui_send_program_change(uint8_t chan, uint8_t prgm) {
 	buffer[0] = 0xC0 + (chan & 0x0F);
 	buffer[1] = prgm;
 	buffer[2] = 0;
-	return write_ui_midi_event(buffer,3);
+	return write_ui_midi_event(buffer,2);
 }
 
 int ui_send_chan_press(uint8_t chan, uint8_t val) {
@@ -1792,7 +3689,7 @@ int ui_send_chan_press(uint8_t chan, uint8_t val) {
 	buffer[0] = 0xD0 + (chan & 0x0F);
 	buffer[1] = val;
 	buffer[2] = 0;
-	return write_ui_midi_event(buffer,3);
+	return write_ui_midi_event(buffer,2);
 }
 
 int ui_send_pitchbend_change(uint8_t chan, uint16_t pb) {
@@ -1804,37 +3701,99 @@ int ui_send_pitchbend_change(uint8_t chan, uint16_t pb) {
 }
 
 int ui_send_master_ccontrol_change(uint8_t ctrl, uint8_t val) {
-	if (midi_filter.master_chan>=0) {
-		return ui_send_ccontrol_change(midi_filter.master_chan, ctrl, val);
+	if (midi_filter_conf.master_chan>=0) {
+		return ui_send_ccontrol_change(midi_filter_conf.master_chan, ctrl, val);
 	}
 }
 
 int ui_send_all_notes_off() {
-	int chan, note;
-	for (chan=0;chan<16;chan++) {
-		for (note=0;note<128;note++) {
-			if (midi_filter.note_state[chan][note]>0) 
-				if (!ui_send_note_off(chan, note, 0)) return 0;
-		}
-	}
-	return 1;
+	return ui_send_panic(0xFFFF, ZYNMIDI_PANIC_NOTES_OFF);
 }
 
 int ui_send_all_notes_off_chan(uint8_t chan) {
-	int note;
-
 	if (chan>15) {
 		fprintf(stderr, "ZynMidiRouter:ui_send_all_notes_off_chan(chan) => chan (%d) is out of range!\n",chan);
 		return 0;
 	}
+	return ui_send_panic(1<<chan, ZYNMIDI_PANIC_NOTES_OFF);
+}
 
-	for (note=0;note<128;note++) {
-		if (midi_filter.note_state[chan][note]>0) 
-			if (!ui_send_note_off(chan, note, 0)) return 0;
-	}
+//------------------------------
+// Panic
+//------------------------------
+// The UI posts a single command word, merged with any pending one, and the RT
+// thread sends the note-offs from the active-note bitsets, through ZMIP_FAKE_UI.
+// Up to PANIC_MAX_EVENTS events are sent per cycle, so a big panic doesn't
+// flood the output buffers. The rest is sent on the next cycles.
+
+#define PANIC_MAX_EVENTS 128
+
+// (chans_mask << 8) | flags
+atomic_uint ui_panic_request;
+
+// Pending panic flags of each channel => Owned by the RT thread
+uint8_t panic_chan_flags[16];
+
+int ui_send_panic(uint16_t chans_mask, uint8_t flags) {
+	if (chans_mask==0 || flags==0) return 0;
+	atomic_fetch_or_explicit(&ui_panic_request, ((uint32_t)chans_mask << 8) | flags, memory_order_release);
 	return 1;
 }
 
+int push_panic_event(uint8_t status, uint8_t num, jack_nframes_t time) {
+	uint8_t *data=event_arena_alloc(3);
+	if (data==NULL) return 0;
+	data[0]=status;
+	data[1]=num;
+	data[2]=0;
+	return zmip_push_event_data(ZMIP_FAKE_UI, data, 3, time);
+}
+
+//Called by the RT thread => Send pending panic events
+int process_panic(jack_nframes_t nframes) {
+	int chan, w;
+	uint32_t req=atomic_exchange_explicit(&ui_panic_request, 0, memory_order_acquire);
+	if (req) {
+		for (chan=0;chan<16;chan++) {
+			if (req & (1<<(chan+8))) panic_chan_flags[chan]|=req & 0xFF;
+		}
+	}
+
+	int budget=zmips[ZMIP_FAKE_UI].max_events-zmips[ZMIP_FAKE_UI].n_events;
+	if (budget>PANIC_MAX_EVENTS) budget=PANIC_MAX_EVENTS;
+	jack_nframes_t time=nframes>0 ? nframes-1 : 0;
+	int n=0;
+
+	for (chan=0;chan<16;chan++) {
+		if (panic_chan_flags[chan]==0) continue;
+		if (panic_chan_flags[chan] & ZYNMIDI_PANIC_NOTES_OFF) {
+			uint32_t *mask=midi_filter.note_mask[chan];
+			for (w=0;w<4;w++) {
+				while (mask[w]) {
+					if (n>=budget) return n;
+					uint8_t note=(w<<5)+__builtin_ctz(mask[w]);
+					if (!push_panic_event((NOTE_OFF << 4) | chan, note, time)) return n;
+					set_note_state(chan, note, 0);
+					n++;
+				}
+			}
+			panic_chan_flags[chan]&=~ZYNMIDI_PANIC_NOTES_OFF;
+		}
+		if (panic_chan_flags[chan] & ZYNMIDI_PANIC_ALL_NOTES_OFF) {
+			if (n>=budget || !push_panic_event((CTRL_CHANGE << 4) | chan, 123, time)) return n;
+			panic_chan_flags[chan]&=~ZYNMIDI_PANIC_ALL_NOTES_OFF;
+			n++;
+		}
+		if (panic_chan_flags[chan] & ZYNMIDI_PANIC_ALL_SOUND_OFF) {
+			if (n>=budget || !push_panic_event((CTRL_CHANGE << 4) | chan, 120, time)) return n;
+			panic_chan_flags[chan]&=~ZYNMIDI_PANIC_ALL_SOUND_OFF;
+			n++;
+		}
+		panic_chan_flags[chan]=0;
+	}
+	return n;
+}
+
 //-----------------------------------------------------
 // MIDI Controller Feedback <= UI and internal
 //-----------------------------------------------------
@@ -1843,37 +3802,14 @@ int ui_send_all_notes_off_chan(uint8_t chan) {
 // Event Ring-Buffer Management
 //------------------------------
 
-uint8_t ctrlfb_midi_data[JACK_MIDI_BUFFER_SIZE];
-
 int write_ctrlfb_midi_event(uint8_t *event_buffer, int event_size) {
-	if (jack_ringbuffer_write_space(jack_ring_ctrlfb_buffer)>=event_size) {
-		if (jack_ringbuffer_write(jack_ring_ctrlfb_buffer, event_buffer, event_size)!=event_size) {
-			fprintf(stderr, "ZynMidiRouter: Error writing controller feedback ring-buffer: INCOMPLETE\n");
-			return 0;
-		}
-	}
-	else {
-		fprintf(stderr, "ZynMidiRouter: Error writing controller feedback ring-buffer: FULL\n");
-		return 0;
-	}
+	if (!write_ring_event(jack_ring_ctrlfb_buffer, ZMIP_FAKE_CTRL_FB, "controller feedback", event_buffer, event_size)) return 0;
 	return 1;
 }
 
 //Get MIDI data from ringbuffer and forward to ZMOP_CTRL via ZMIP_FAKE_CTRL_FB
 int forward_ctrlfb_midi_data() {
-	int nb=jack_ringbuffer_read_space(jack_ring_ctrlfb_buffer);
-	if (jack_ringbuffer_read(jack_ring_ctrlfb_buffer, ctrlfb_midi_data, nb)!=nb) {
-		fprintf(stderr, "ZynMidiRouter: Error reading midi data from controller feedback ring-buffer: %d bytes\n", nb);
-		return -1;
-	}
-
-	//TODO: Avoid buffer overflow => check that nb<=(JACK_MIDI_BUFFER_SIZE-n_data)
-	int j;
-	for (j=0;j<nb/3;j++) {
-		zmip_push_event_data(ZMIP_FAKE_CTRL_FB, ctrlfb_midi_data+j*3);
-	}
-	return j;
-
+	return forward_ring_events(jack_ring_ctrlfb_buffer, &jack_ring_ctrlfb_consumed, ZMIP_FAKE_CTRL_FB);
 }
 
 //------------------------------
@@ -1909,7 +3845,7 @@ int ctrlfb_send_program_change(uint8_t chan, uint8_t prgm) {
 	buffer[0] = 0xC0 + (chan & 0x0F);
 	buffer[1] = prgm;
 	buffer[2] = 0;
-	return write_ctrlfb_midi_event(buffer,3);
+	return write_ctrlfb_midi_event(buffer,2);
 }
 
 int ctrlfb_send_chan_press(uint8_t chan, uint8_t val) {
@@ -1917,7 +3853,7 @@ int ctrlfb_send_chan_press(uint8_t chan, uint8_t val) {
 	buffer[0] = 0xD0 + (chan & 0x0F);
 	buffer[1] = val;
 	buffer[2] = 0;
-	return write_ctrlfb_midi_event(buffer,3);
+	return write_ctrlfb_midi_event(buffer,2);
 }
 
 int ctrlfb_send_pitchbend_change(uint8_t chan, uint16_t pb) {
@@ -1933,55 +3869,202 @@ int ctrlfb_send_pitchbend_change(uint8_t chan, uint16_t pb) {
 // MIDI Internal Ouput Events Buffer => UI
 //-----------------------------------------------------------------------------
 
+// Multi-producer/single-consumer ring: the RT thread writes from jack_process_zmip
+// and non-RT threads (zyncoder, zynaptik, zyntof ...) write through the send
+// functions below, concurrently. Writers reserve a slot with a CAS on the write
+// counter, store the event and commit it by setting the slot sequence (release).
+// The reader takes a slot only once it's committed, and frees it for the next lap
+// by advancing its sequence. Counters are free-running, ZYNMIDI_BUFFER_SIZE is a power of 2.
+
+#if (ZYNMIDI_BUFFER_SIZE & (ZYNMIDI_BUFFER_SIZE-1))
+#error "ZYNMIDI_BUFFER_SIZE must be a power of 2"
+#endif
+
 uint32_t zynmidi_buffer[ZYNMIDI_BUFFER_SIZE];
-int zynmidi_buffer_read;
-int zynmidi_buffer_write;
+atomic_uint zynmidi_buffer_seq[ZYNMIDI_BUFFER_SIZE];		// Slot lap => pos when free, pos+1 when committed
+atomic_uint zynmidi_buffer_read;
+atomic_uint zynmidi_buffer_write;
+atomic_int zynmidi_notify;
+
+zynmidi_event_t zynmidi_events[ZYNMIDI_EVENT_BUFFER_SIZE];
+atomic_int zynmidi_events_read;
+atomic_int zynmidi_events_write;
 
 int init_zynmidi_buffer() {
 	int i;
-	for (i=0;i<ZYNMIDI_BUFFER_SIZE;i++) zynmidi_buffer[i]=0;
-	zynmidi_buffer_read=zynmidi_buffer_write=0;
+	for (i=0;i<ZYNMIDI_BUFFER_SIZE;i++) {
+		zynmidi_buffer[i]=0;
+		atomic_store(&zynmidi_buffer_seq[i], i);
+	}
+	atomic_store(&zynmidi_buffer_read, 0);
+	atomic_store(&zynmidi_buffer_write, 0);
+	atomic_store(&zynmidi_notify, 0);
+	atomic_store(&zynmidi_events_read, 0);
+	atomic_store(&zynmidi_events_write, 0);
+	init_zynui_eventfd();
 	return 1;
 }
 
 int write_zynmidi(uint32_t ev) {
-	int nptr=zynmidi_buffer_write+1;
-	if (nptr>=ZYNMIDI_BUFFER_SIZE) nptr=0;
-	if (nptr==zynmidi_buffer_read) return 0;
-	zynmidi_buffer[zynmidi_buffer_write]=ev;
-	zynmidi_buffer_write=nptr;
+	unsigned int pos=atomic_load_explicit(&zynmidi_buffer_write, memory_order_relaxed);
+	while (1) {
+		unsigned int seq=atomic_load_explicit(&zynmidi_buffer_seq[pos & (ZYNMIDI_BUFFER_SIZE-1)], memory_order_acquire);
+		int diff=(int)(seq-pos);
+		if (diff==0) {
+			//Slot is free => reserve it. On failure, pos is reloaded with the current counter.
+			if (atomic_compare_exchange_weak_explicit(&zynmidi_buffer_write, &pos, pos+1, memory_order_relaxed, memory_order_relaxed)) break;
+		}
+		else if (diff<0) {
+			//Slot not read yet => full
+			count_zynmidi_dropped();
+			return 0;
+		}
+		else pos=atomic_load_explicit(&zynmidi_buffer_write, memory_order_relaxed);
+	}
+	zynmidi_buffer[pos & (ZYNMIDI_BUFFER_SIZE-1)]=ev;
+	atomic_store_explicit(&zynmidi_buffer_seq[pos & (ZYNMIDI_BUFFER_SIZE-1)], pos+1, memory_order_release);
+	atomic_store_explicit(&zynmidi_notify, 1, memory_order_relaxed);
 	return 1;
 }
 
+//Signal the UI eventfd once if events were written since last call.
+//Called at the end of every jack cycle and by the non-RT send functions.
+void notify_zynmidi() {
+	if (atomic_exchange_explicit(&zynmidi_notify, 0, memory_order_relaxed)) notify_zynui_event();
+}
+
+//Reader side => Is the slot at "pos" committed?
+int is_zynmidi_committed(unsigned int pos) {
+	return atomic_load_explicit(&zynmidi_buffer_seq[pos & (ZYNMIDI_BUFFER_SIZE-1)], memory_order_acquire)==pos+1;
+}
+
 uint32_t read_zynmidi() {
-	if (zynmidi_buffer_read==zynmidi_buffer_write) return 0;
-	uint32_t ev=zynmidi_buffer[zynmidi_buffer_read++];
-	if (zynmidi_buffer_read>=ZYNMIDI_BUFFER_SIZE) zynmidi_buffer_read=0;
+	unsigned int pos=atomic_load_explicit(&zynmidi_buffer_read, memory_order_relaxed);
+	if (!is_zynmidi_committed(pos)) return 0;
+	uint32_t ev=zynmidi_buffer[pos & (ZYNMIDI_BUFFER_SIZE-1)];
+	//Free the slot for the next lap
+	atomic_store_explicit(&zynmidi_buffer_seq[pos & (ZYNMIDI_BUFFER_SIZE-1)], pos+ZYNMIDI_BUFFER_SIZE, memory_order_release);
+	atomic_store_explicit(&zynmidi_buffer_read, pos+1, memory_order_relaxed);
 	return ev;
 }
 
+//Copy up to "max" pending events to "out" => Return the number of events copied.
+//Stops at the first slot not committed yet, so events keep their order.
+int read_zynmidi_batch(uint32_t *out, int max) {
+	int n=0;
+	unsigned int pos=atomic_load_explicit(&zynmidi_buffer_read, memory_order_relaxed);
+	while (n<max && is_zynmidi_committed(pos)) {
+		out[n++]=zynmidi_buffer[pos & (ZYNMIDI_BUFFER_SIZE-1)];
+		atomic_store_explicit(&zynmidi_buffer_seq[pos & (ZYNMIDI_BUFFER_SIZE-1)], pos+ZYNMIDI_BUFFER_SIZE, memory_order_release);
+		pos++;
+	}
+	atomic_store_explicit(&zynmidi_buffer_read, pos, memory_order_relaxed);
+	return n;
+}
+
+//Number of pending events, including the ones being written
+int get_zynmidi_count() {
+	return (int)(atomic_load_explicit(&zynmidi_buffer_write, memory_order_relaxed)-atomic_load_explicit(&zynmidi_buffer_read, memory_order_relaxed));
+}
+
+//Next pending event, without removing it => 0 if empty
+uint32_t peek_zynmidi() {
+	unsigned int pos=atomic_load_explicit(&zynmidi_buffer_read, memory_order_relaxed);
+	if (!is_zynmidi_committed(pos)) return 0;
+	return zynmidi_buffer[pos & (ZYNMIDI_BUFFER_SIZE-1)];
+}
+
 //-----------------------------------------------------------------------------
 // MIDI Internal Output: Send Functions => UI
 //-----------------------------------------------------------------------------
 
 int write_zynmidi_ccontrol_change(uint8_t chan, uint8_t num, uint8_t val) {
 	uint32_t ev = ((0xB0 | (chan & 0x0F)) << 16) | (num << 8) | val;
-	return write_zynmidi(ev);
+	int res=write_zynmidi(ev);
+	notify_zynmidi();
+	return res;
 }
 
 int write_zynmidi_note_on(uint8_t chan, uint8_t num, uint8_t val) {
 	uint32_t ev = ((0x90 | (chan & 0x0F)) << 16) | (num << 8) | val;
-	return write_zynmidi(ev);
+	int res=write_zynmidi(ev);
+	notify_zynmidi();
+	return res;
 }
 
 int write_zynmidi_note_off(uint8_t chan, uint8_t num, uint8_t val) {
 	uint32_t ev = ((0x80 | (chan & 0x0F)) << 16) | (num << 8) | val;
-	return write_zynmidi(ev);
+	int res=write_zynmidi(ev);
+	notify_zynmidi();
+	return res;
 }
 
 int write_zynmidi_program_change(uint8_t chan, uint8_t num) {
 	uint32_t ev = ((0xC0 | (chan & 0x0F)) << 16) | (num << 8);
-	return write_zynmidi(ev);
+	int res=write_zynmidi(ev);
+	notify_zynmidi();
+	return res;
+}
+
+//-----------------------------------------------------------------------------
+// MIDI Internal Output Wide Events Buffer => UI
+//-----------------------------------------------------------------------------
+// Single-producer/single-consumer ring => Only the RT thread writes it. The writer
+// publishes the write index with release ordering after storing the event, the
+// reader publishes the read index with release ordering after loading it.
+
+//Called by the RT thread => time is the event offset in the current cycle
+int write_zynmidi_event(int izmip, jack_nframes_t time, uint8_t *buffer, size_t size, uint8_t flags) {
+	if (size<1) return 0;
+	int wptr=atomic_load_explicit(&zynmidi_events_write, memory_order_relaxed);
+	int nptr=wptr+1;
+	if (nptr>=ZYNMIDI_EVENT_BUFFER_SIZE) nptr=0;
+	if (nptr==atomic_load_explicit(&zynmidi_events_read, memory_order_acquire)) {
+		count_zynmidi_dropped();
+		return 0;
+	}
+
+	zynmidi_event_t *xev=zynmidi_events+wptr;
+	xev->time=cycle_frame_time+time;
+	xev->izmip=(izmip>=0 && izmip<MAX_NUM_ZMIPS) ? izmip : ZYNMIDI_NO_ZMIP;
+	xev->flags=flags;
+	xev->size=size>255 ? 255 : size;
+	xev->status=buffer[0];
+	memset(xev->data, 0, ZYNMIDI_EVENT_DATA_SIZE);
+	if (size-1>ZYNMIDI_EVENT_DATA_SIZE) {
+		xev->flags|=FLAG_ZYNMIDI_TRUNCATED;
+		memcpy(xev->data, buffer+1, ZYNMIDI_EVENT_DATA_SIZE);
+	} else {
+		memcpy(xev->data, buffer+1, size-1);
+	}
+
+	atomic_store_explicit(&zynmidi_events_write, nptr, memory_order_release);
+	atomic_store_explicit(&zynmidi_notify, 1, memory_order_relaxed);
+	return 1;
+}
+
+//Copy up to "max" pending events to "out" => Return the number of events copied
+int read_zynmidi_events(zynmidi_event_t *out, int max) {
+	int rptr=atomic_load_explicit(&zynmidi_events_read, memory_order_relaxed);
+	int wptr=atomic_load_explicit(&zynmidi_events_write, memory_order_acquire);
+	int n=wptr-rptr;
+	if (n<0) n+=ZYNMIDI_EVENT_BUFFER_SIZE;
+	if (n>max) n=max;
+	if (n<=0) return 0;
+	int n0=ZYNMIDI_EVENT_BUFFER_SIZE-rptr;
+	if (n0>n) n0=n;
+	memcpy(out, zynmidi_events+rptr, n0*sizeof(zynmidi_event_t));
+	memcpy(out+n0, zynmidi_events, (n-n0)*sizeof(zynmidi_event_t));
+	rptr+=n;
+	if (rptr>=ZYNMIDI_EVENT_BUFFER_SIZE) rptr-=ZYNMIDI_EVENT_BUFFER_SIZE;
+	atomic_store_explicit(&zynmidi_events_read, rptr, memory_order_release);
+	return n;
+}
+
+int get_zynmidi_events_count() {
+	int n=atomic_load_explicit(&zynmidi_events_write, memory_order_acquire)-atomic_load_explicit(&zynmidi_events_read, memory_order_relaxed);
+	if (n<0) n+=ZYNMIDI_EVENT_BUFFER_SIZE;
+	return n;
 }
 
 //-----------------------------------------------------------------------------
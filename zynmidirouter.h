@@ -96,6 +96,33 @@ typedef struct mf_clone_st {
 	uint8_t cc[128];
 } mf_clone_t;
 
+//Compiled clone config for a source channel => enabled targets & 128-bit CC mask per target
+typedef struct mf_clone_fanout_st {
+	int n_chans;
+	uint16_t chans_mask;
+	uint8_t chans[16];
+	uint32_t cc_mask[16][4];
+} mf_clone_fanout_t;
+
+//128-bit masks, as uint32_t[4], indexed by a 7-bit MIDI number
+#define MASK128_TEST(m,n) ((m)[((n) & 0x7F)>>5] & (1u<<((n) & 0x1F)))
+#define MASK128_SET(m,n) ((m)[((n) & 0x7F)>>5] |= (1u<<((n) & 0x1F)))
+#define MASK128_CLEAR(m,n) ((m)[((n) & 0x7F)>>5] &= ~(1u<<((n) & 0x1F)))
+
+//Sparse event_map & cc_swap => Only non-identity entries are stored, sorted by key.
+//Tables 0-7 are the event_map for (type & 0x7), table 8 is the cc_swap.
+#define MF_MAP_TABLES 9
+#define MF_MAP_CC_SWAP 8
+//Room for mapping or ignoring every Note-On, Note-Off & CC on all channels, plus a full CC swap.
+//Larger configs are rejected by the setters, keeping the current mapping.
+#define MAX_NUM_MF_MAPS (4*16*128)
+#define MF_MAP_KEY(t,c,n) (((t)<<11) | (((c) & 0x0F)<<7) | ((n) & 0x7F))
+
+typedef struct mf_map_entry_st {
+	uint16_t key;
+	midi_event_t ev;
+} mf_map_entry_t;
+
 static uint8_t default_cc_to_clone[]={ 1, 2, 64, 65, 66, 67, 68 };
 
 typedef struct mf_noterange_st {
@@ -105,20 +132,8 @@ typedef struct mf_noterange_st {
 	int8_t halftone_trans;
 } mf_noterange_t;
 
+//MIDI filter runtime state => Owned by the RT thread
 typedef struct midi_filter_st {
-	int tuning_pitchbend;
-	int master_chan;
-	int active_chan;
-	int last_active_chan;
-	int system_events;
-	int cc_automode;
-
-	mf_noterange_t noterange[16];
-	mf_clone_t clone[16][16];
-
-	midi_event_t event_map[8][16][128];
-	midi_event_t cc_swap[16][128];
-
 	uint8_t ctrl_mode[16][128];
 	uint8_t ctrl_relmode_count[16][128];
 
@@ -126,6 +141,7 @@ typedef struct midi_filter_st {
 	uint16_t last_pb_val[16];
 
 	uint8_t note_state[16][128];
+	uint32_t note_mask[16][4];		// Sounding notes of each channel => MASK128
 } midi_filter_t;
 midi_filter_t midi_filter;
 
@@ -195,6 +211,10 @@ void set_midi_filter_system_events(int mfse);
 int midi_learning_mode;
 void set_midi_learning_mode(int mlm);
 
+//MIDI Filter & Routing batch configuration => Edits are published at once on commit
+int midi_filter_begin_batch();
+int midi_filter_commit_batch();
+
 //MIDI Filter Swap Mapping
 int get_mf_arrow_from(uint8_t chan, uint8_t num, mf_arrow_t *arrow);
 int get_mf_arrow_to(uint8_t chan, uint8_t num, mf_arrow_t *arrow);
@@ -202,6 +222,7 @@ int set_midi_filter_cc_swap(uint8_t chan_from, uint8_t num_from, uint8_t chan_to
 int del_midi_filter_cc_swap(uint8_t chan, uint8_t num);
 uint16_t get_midi_filter_cc_swap(uint8_t chan, uint8_t num);
 void reset_midi_filter_cc_swap();
+int check_midi_filter_cc_swap();
 
 //-----------------------------------------------------------------------------
 // Zynmidi Ports
@@ -277,17 +298,33 @@ void reset_midi_filter_cc_swap();
 #define ZMIP_STEP_FLAGS (FLAG_ZMIP_UI|FLAG_ZMIP_ZYNCODER|FLAG_ZMIP_CLONE|FLAG_ZMIP_FILTER|FLAG_ZMIP_SWAP|FLAG_ZMIP_NOTERANGE)
 #define ZMIP_CTRL_FLAGS (FLAG_ZMIP_UI)
 
+//Spill queue => events that didn't fit in the jack port buffer are carried, in order, into the
+//next cycles. Records are a 2-bytes size followed by the MIDI message.
+#define ZMOP_SPILL_SIZE 4096
+#define ZMOP_SPILL_MAX_EVENTS 256
+
+struct zmop_spill_st {
+	uint8_t data[ZMOP_SPILL_SIZE];
+	int head;						// Offset of the first queued record
+	int tail;						// Offset after the last queued record
+	int n_events;
+	uint32_t n_spilled;				// Events that were queued
+	uint32_t n_dropped;				// Events lost because the queue was full
+};
+
 struct zmop_st {
 	jack_port_t *jport;
 	int midi_chans[16];
 	int route_from_zmips[MAX_NUM_ZMIPS];
-	int event_counter[MAX_NUM_ZMIPS];
+	int event_counter;				// Index of next event in the merged timeline
 	uint32_t flags;
 	int n_connections;
+	struct zmop_spill_st spill;
 };
 struct zmop_st zmops[MAX_NUM_ZMOPS];
 
 int zmop_init(int iz, char *name, int midi_chan, uint32_t flags);
+int zmop_destroy(int iz);
 int zmop_set_flags(int iz, uint32_t flags);
 int zmop_has_flags(int iz, uint32_t flag);
 int zmop_chain_set_flag_droppc(int iz, uint8_t flag);
@@ -299,24 +336,116 @@ int zmop_reset_route_from(int iz);
 int zmop_set_route_from(int izmop, int izmip, int route);
 int zmop_get_route_from(int izmop, int izmip);
 int zmop_reset_event_counters(int iz);
+int zmop_update_routes(int iz);
 jack_midi_event_t *zmop_pop_event(int izmop, int *izmip);
+int zmop_write_event(int iz, void *port_buffer, jack_nframes_t time, jack_midi_data_t *data, size_t size);
+int zmop_flush_spill(int iz, void *port_buffer);
+int zmop_reset_spill(int iz);
+int zmop_get_spill_len(int iz);
+uint32_t zmop_get_spilled_events(int iz);
+uint32_t zmop_get_dropped_events(int iz);
+int set_zmop_spill_max(int max_events);
+int get_zmop_spill_max();
 
 
 struct zmip_st {
 	jack_port_t *jport;
 	uint32_t flags;
-	jack_midi_event_t events[JACK_MIDI_BUFFER_SIZE];
+	jack_midi_event_t *events;		// Segment of the shared event pool, set when the zmip is processed
 	int n_events;
+	int max_events;
 };
 struct zmip_st zmips[MAX_NUM_ZMIPS];
 
+//Events of all zmips are stored in a single per-cycle pool. Every zmip processed
+//in a cycle takes the next segment, so memory scales with the events, not the ports.
+#define ZMIP_EVENT_POOL_SIZE MAX_NUM_TIMELINE_EVENTS
+
 int zmip_init(int iz, char *name, uint32_t flags);
+int zmip_destroy(int iz);
+int zmip_open_events(int iz);
 int zmip_set_flags(int iz, uint32_t flags);
 int zmip_has_flags(int iz, uint32_t flag);
 int zmip_push_data(int iz, jack_midi_event_t *ev);
+int zmip_push_event_data(int iz, uint8_t *data, size_t size, jack_nframes_t time);
 int zmip_clear_events(int iz);
 int zmips_clear_events();
 
+//-----------------------------------------------------------------------------
+// Merged Event Timeline
+//-----------------------------------------------------------------------------
+// Events from all zmips, merged once per cycle in time order and tagged with
+// the source zmip. Every zmop walks this single stream, testing its route mask.
+
+#define MAX_NUM_TIMELINE_EVENTS (4*JACK_MIDI_BUFFER_SIZE)
+
+typedef struct timeline_event_st {
+	jack_midi_event_t *ev;
+	int izmip;
+	uint32_t zmop_mask;		// Destination zmops, computed once when merging
+} timeline_event_t;
+
+int zmips_merge_events();
+
+//-----------------------------------------------------------------------------
+// Port Connections
+//-----------------------------------------------------------------------------
+// Connection counters are updated by the backend callbacks. Only zmips with
+// connections (or raw MIDI input) and zmops with connections are processed.
+// Ports can be created (zmip_init/zmop_init) and destroyed at runtime. A port
+// is unregistered once the RT thread has rebuilt the lists without it.
+
+void add_port_connections(jack_port_t *port, int delta);
+void set_ports_changed();
+int get_zmip_connections(int iz);
+int get_zmop_connections(int iz);
+void update_active_ports();
+void clear_idle_zmops(jack_nframes_t nframes);
+int wait_active_ports_update();
+
+//-----------------------------------------------------------------------------
+// MIDI Filter & Routing Configuration Snapshot
+//-----------------------------------------------------------------------------
+
+//Edited by the UI thread on "midi_filter_conf" and published as an immutable
+//snapshot that the RT thread picks at the start of every cycle.
+typedef struct midi_filter_conf_st {
+	int tuning_pitchbend;
+	int master_chan;
+	int active_chan;
+	int last_active_chan;
+	int system_events;
+	int cc_automode;
+
+	mf_noterange_t noterange[16];
+	mf_clone_fanout_t clone_fanout[16];
+
+	//Compiled zmop routing => bit i set when zmop i receives events from a zmip / channel (MAX_NUM_ZMOPS<=32)
+	uint32_t zmip_route_zmops[MAX_NUM_ZMIPS];
+	uint32_t chan_route_zmops[16];
+	uint8_t zmop_chans_trans[MAX_NUM_ZMOPS][16];
+
+	//Sparse event_map & cc_swap => presence bit per (table, chan, num) + sorted mapping store.
+	//The store must be the last field: only the used part of it is copied to the snapshots.
+	uint32_t map_mask[MF_MAP_TABLES][16][4];
+	int n_maps;
+	mf_map_entry_t maps[MAX_NUM_MF_MAPS];
+} midi_filter_conf_t;
+midi_filter_conf_t midi_filter_conf;
+
+//Clone config as set by the API. Not part of the snapshot, it's compiled into "clone_fanout".
+mf_clone_t midi_filter_clone[16][16];
+void update_midi_filter_clone_fanout(uint8_t chan_from);
+
+//Event map & CC swap tables as set by the API. Not part of the snapshot, they're compiled into "maps".
+midi_event_t midi_filter_event_map[8][16][128];
+midi_event_t midi_filter_cc_swap[16][128];
+//Inverse of cc_swap => (chan<<8 | num) of the node with the arrow pointing to each node
+uint16_t midi_filter_cc_swap_inv[16][128];
+int update_midi_filter_map(int table, uint8_t chan, uint8_t num);
+void rebuild_midi_filter_maps();
+midi_event_t *lookup_midi_filter_map(midi_filter_conf_t *mfc, int table, uint8_t chan, uint8_t num);
+
 //-----------------------------------------------------------------------------
 // Jack MIDI Process
 //-----------------------------------------------------------------------------
@@ -325,7 +454,147 @@ jack_client_t *jack_client;
 
 int init_jack_midi(char *name);
 int end_jack_midi();
+int init_midi_ports(jack_nframes_t nframes);
 int jack_process(jack_nframes_t nframes, void *arg);
+int jack_buffer_size(jack_nframes_t nframes, void *arg);
+
+//-----------------------------------------------------------------------------
+// MIDI Port Backends
+//-----------------------------------------------------------------------------
+// The router only reaches ports through this interface. Port handles are opaque
+// and owned by the backend: the JACK backend forwards to jackd, the offline
+// backend keeps port buffers in memory, so the production code path can run
+// without a jack server (tests, benchmarks, trace replay ...).
+
+typedef struct zynmidi_backend_st {
+	const char *name;
+	jack_port_t *(*port_register)(const char *name, int output);
+	int (*port_unregister)(jack_port_t *port);
+	void *(*port_get_buffer)(jack_port_t *port, jack_nframes_t nframes);
+	uint32_t (*get_event_count)(void *port_buffer);
+	int (*event_get)(jack_midi_event_t *ev, void *port_buffer, uint32_t index);
+	void (*clear_buffer)(void *port_buffer);
+	int (*event_write)(void *port_buffer, jack_nframes_t time, const jack_midi_data_t *data, size_t size);
+	jack_nframes_t (*last_frame_time)();
+	jack_nframes_t (*frame_time)();
+	jack_nframes_t (*get_sample_rate)();
+} zynmidi_backend_t;
+
+zynmidi_backend_t *zynmidi_backend;
+
+//Offline backend => Input events are pushed before running a cycle, output events are read after it.
+//All ports are connected by default. Ports created after init start disconnected.
+
+#define OFFLINE_PORT_MAX_EVENTS 1024
+#define OFFLINE_PORT_DATA_SIZE 8192
+
+typedef struct offline_port_st {
+	char name[32];
+	int output;
+	int n_connections;
+	uint32_t n_events;
+	size_t data_used;
+	jack_midi_event_t events[OFFLINE_PORT_MAX_EVENTS];
+	jack_midi_data_t data[OFFLINE_PORT_DATA_SIZE];
+} offline_port_t;
+
+int init_zynmidirouter_offline(jack_nframes_t nframes, jack_nframes_t sample_rate);
+int end_zynmidirouter_offline();
+int offline_process_cycle();
+jack_nframes_t offline_get_frame_time();
+int offline_zmip_push_event(int iz, jack_nframes_t time, jack_midi_data_t *data, size_t size);
+int offline_zmip_clear_events(int iz);
+int offline_zmip_set_connections(int iz, int n);
+int offline_zmop_set_connections(int iz, int n);
+int offline_zmop_get_event_count(int iz);
+int offline_zmop_get_event(int iz, int i, jack_midi_event_t *ev);
+
+//-----------------------------------------------------------------------------
+// Per-cycle Event Arena
+//-----------------------------------------------------------------------------
+// Bump allocator for cloned & rewritten event data, shared by all zmips and
+// reset at the start of every cycle. When it's full, remaining clones of the
+// event are dropped (originals always pass) and the overflow counter increases.
+
+#define EVENT_ARENA_BYTES_PER_FRAME 64
+#define EVENT_ARENA_MIN_SIZE (4*JACK_MIDI_BUFFER_SIZE)
+
+int init_event_arena(jack_nframes_t nframes);
+void end_event_arena();
+void reset_event_arena();
+uint8_t *event_arena_alloc(size_t size);
+uint32_t get_event_arena_overflows();
+
+//-----------------------------------------------------------------------------
+// Router Statistics
+//-----------------------------------------------------------------------------
+// Counters are accumulated by the RT thread and published once per cycle under
+// a sequence counter, so readers get a consistent copy without taking locks.
+
+typedef struct zmip_stats_st {
+	uint32_t n_in;				// Events received (port, or ring-buffer for fake zmips)
+	uint32_t n_filtered;		// Events discarded by the filter (ignored, captured, out of range ...)
+	uint32_t n_cloned;			// Clones generated
+	uint32_t n_mapped;			// Events rewritten by event map or CC swap
+	uint32_t n_dropped;			// Events lost because an event buffer or ring-buffer was full
+	uint32_t peak_in;			// Max events received in a cycle
+} zmip_stats_t;
+
+typedef struct zmop_stats_st {
+	uint32_t n_out;				// Events written to the jack port buffer
+	uint32_t n_spilled;			// Events that didn't fit the port buffer, queued to next cycles
+	uint32_t n_dropped;			// Events lost because the spill queue was full
+	uint32_t peak_out;			// Max events written in a cycle
+} zmop_stats_t;
+
+typedef struct zynmidirouter_stats_st {
+	uint32_t n_cycles;
+	uint32_t n_arena_overflows;	// Clones dropped because the event arena was full
+	uint32_t n_ui_dropped;		// Events lost because the UI buffers were full
+	zmip_stats_t zmips[MAX_NUM_ZMIPS];
+	zmop_stats_t zmops[MAX_NUM_ZMOPS];
+} zynmidirouter_stats_t;
+
+zynmidirouter_stats_t zynmidirouter_rt_stats;
+
+int get_zynmidirouter_stats(zynmidirouter_stats_t *stats);
+void reset_zynmidirouter_stats();
+void publish_zynmidirouter_stats();
+void count_zmip_ring_dropped(int iz);
+void count_zynmidi_dropped();
+
+//-----------------------------------------------------------------------------
+// Cycle-time Profiler
+//-----------------------------------------------------------------------------
+// When enabled, every stage of jack_process is timed with the monotonic clock.
+// Histogram bucket i counts the stage times in [2^i, 2^(i+1)) nanoseconds, the
+// last bucket counting also longer times. When disabled, the cost is a flag test.
+
+#define PROFILE_STAGE_INPUT 0		// jack zmips
+#define PROFILE_STAGE_INTERNAL 1	// internal ring-buffer
+#define PROFILE_STAGE_UI 2			// UI ring-buffer
+#define PROFILE_STAGE_CTRLFB 3		// controller feedback ring-buffer
+#define PROFILE_STAGE_OUTPUT 4		// merge & zmops
+#define PROFILE_STAGE_CYCLE 5		// whole jack_process
+#define PROFILE_NUM_STAGES 6
+
+#define PROFILE_HIST_BUCKETS 24
+
+typedef struct zynmidirouter_profile_st {
+	uint32_t n_cycles;
+	uint32_t n_overruns;		// Cycles taking longer than the period
+	uint32_t period_ns;			// Period duration of the last cycle
+	uint32_t max_ns[PROFILE_NUM_STAGES];
+	uint64_t total_ns[PROFILE_NUM_STAGES];
+	uint32_t hist[PROFILE_NUM_STAGES][PROFILE_HIST_BUCKETS];
+} zynmidirouter_profile_t;
+
+void set_zynmidirouter_profiling(int enable);
+int get_zynmidirouter_profiling();
+int get_zynmidirouter_profile(zynmidirouter_profile_t *profile);
+void reset_zynmidirouter_profile();
+void dump_zynmidirouter_profile();
+int enable_zynmidirouter_profile_dump();
 
 //-----------------------------------------------------------------------------
 // MIDI Input Events Buffer Management and Send functions
@@ -333,11 +602,37 @@ int jack_process(jack_nframes_t nframes, void *arg);
 
 #define ZYNMIDI_BUFFER_SIZE 1024
 
+//Internal, UI & controller feedback ring-buffers carry framed records: this header followed by
+//"size" bytes of MIDI message. The frame time is captured by the writer and mapped to a frame
+//offset in the cycle that reads the event, delayed by the event latency.
+typedef struct ring_event_st {
+	jack_nframes_t time;
+	uint32_t size;
+} ring_event_t;
+
+//Start frame & size of the current cycle, set by jack_process
+jack_nframes_t cycle_frame_time;
+jack_nframes_t cycle_nframes;
+
+//Event latency in frames. Default (<0) is one period, so events keep their relative time.
+//Zero sends events ASAP, at the start of the next cycle.
+int set_midi_event_latency(int nframes);
+int get_midi_event_latency();
+jack_nframes_t ring_event_offset(jack_nframes_t time);
+jack_nframes_t ring_event_time();
+
+int write_ring_event(jack_ringbuffer_t *rb, int iz, const char *name, uint8_t *event_buffer, int event_size);
+int write_ring_event_time(jack_ringbuffer_t *rb, int iz, const char *name, jack_nframes_t time, uint8_t *event_buffer, int event_size);
+int read_ring_events(jack_ringbuffer_t *rb, size_t *consumed, jack_midi_event_t *events, int max_events, int *n_lost);
+int forward_ring_events(jack_ringbuffer_t *rb, size_t *consumed, int iz);
+void release_ring_events(jack_ringbuffer_t *rb, size_t *consumed);
+
 //-----------------------------------------------------
 // MIDI Internal Input <= internal (zyncoder)
 //-----------------------------------------------------
 
 jack_ringbuffer_t *jack_ring_internal_buffer;
+size_t jack_ring_internal_consumed;
 int write_internal_event(uint8_t *event, int event_size);
 int forward_internal_midi_data();
 
@@ -353,6 +648,7 @@ int internal_send_pitchbend_change(uint8_t chan, uint16_t pb);
 //-----------------------------------------------------
 
 jack_ringbuffer_t *jack_ring_ui_buffer;
+size_t jack_ring_ui_consumed;
 int write_ui_event(uint8_t *event, int event_size);
 int forward_ui_midi_data();
 
@@ -366,11 +662,20 @@ int ui_send_master_ccontrol_change(uint8_t ctrl, uint8_t val);
 int ui_send_all_notes_off();
 int ui_send_all_notes_off_chan(uint8_t chan);
 
+//Panic => Run by the RT thread, spread over several cycles if needed
+#define ZYNMIDI_PANIC_NOTES_OFF 1			// Note-off for every sounding note
+#define ZYNMIDI_PANIC_ALL_NOTES_OFF 2		// CC123 "All Notes Off"
+#define ZYNMIDI_PANIC_ALL_SOUND_OFF 4		// CC120 "All Sound Off"
+
+int ui_send_panic(uint16_t chans_mask, uint8_t flags);
+int process_panic(jack_nframes_t nframes);
+
 //-----------------------------------------------------
 // MIDI Controller Feedback <= UI & internal (zyncoder)
 //-----------------------------------------------------
 
 jack_ringbuffer_t *jack_ring_ctrlfb_buffer;
+size_t jack_ring_ctrlfb_consumed;
 int write_ctrlfb_event(uint8_t *event, int event_size);
 int forward_ctrlfb_midi_data();
 
@@ -381,13 +686,39 @@ int ctrlfb_send_program_change(uint8_t chan, uint8_t prgm);
 int ctrlfb_send_chan_press(uint8_t chan, uint8_t val);
 int ctrlfb_send_pitchbend_change(uint8_t chan, uint16_t pb);
 
+//-----------------------------------------------------------------------------
+// Raw MIDI Input <= ALSA rawmidi devices & pipes
+//-----------------------------------------------------------------------------
+// Feed a zmip directly from a rawmidi device (or a pipe / FIFO for testing),
+// bypassing a2jmidid. Events are timestamped on arrival with the jack frame time.
+// ALSA devices are supported when built with HAVE_ALSA_RAWMIDI.
+
+#define ZMIP_RAWMIDI_RING_SIZE 8192
+#define ZMIP_RAWMIDI_MAX_EVENTS 512
+#define ZMIP_RAWMIDI_SYSEX_SIZE 1024
+#define ZMIP_RAWMIDI_MAX_PFDS 8
+
+struct zmip_rawmidi_st;
+
+int zmip_open_rawmidi(int iz, const char *device);
+int zmip_close_rawmidi(int iz);
+int zmip_has_rawmidi(int iz);
+void zmip_rawmidi_close_device(struct zmip_rawmidi_st *rm);
+struct zmip_rawmidi_st *zmip_rawmidi_read_events(int iz);
+int zmip_next_input_event(void *port_buffer, int *i, struct zmip_rawmidi_st *rm, jack_midi_event_t *ev);
+void release_zmip_rawmidi_events();
+
 //-----------------------------------------------------------------------------
 // MIDI Internal Ouput Events Buffer => UI
 //-----------------------------------------------------------------------------
 
 int init_zynmidi_buffer();
 int write_zynmidi(uint32_t ev);
+void notify_zynmidi();
 uint32_t read_zynmidi();
+int read_zynmidi_batch(uint32_t *out, int max);
+int get_zynmidi_count();
+uint32_t peek_zynmidi();
 
 int write_zynmidi_ccontrol_change(uint8_t chan, uint8_t num, uint8_t val);
 int write_zynmidi_note_on(uint8_t chan, uint8_t num, uint8_t val);
@@ -395,3 +726,31 @@ int write_zynmidi_note_off(uint8_t chan, uint8_t num, uint8_t val);
 int write_zynmidi_program_change(uint8_t chan, uint8_t num);
 
 //-----------------------------------------------------------------------------
+// MIDI Internal Output Wide Events Buffer => UI
+//-----------------------------------------------------------------------------
+// Written by the RT thread together with the packed zynmidi buffer, but keeping
+// the source zmip, the frame time and up to 9 bytes of message.
+
+#define ZYNMIDI_EVENT_BUFFER_SIZE 1024
+#define ZYNMIDI_EVENT_DATA_SIZE 8
+
+#define ZYNMIDI_NO_ZMIP 0xFF
+
+#define FLAG_ZYNMIDI_LEARN 1		// Captured before filtering, for MIDI learning
+#define FLAG_ZYNMIDI_MASTER 2		// Master channel event
+#define FLAG_ZYNMIDI_TRUNCATED 4	// Message longer than the record => data is truncated
+
+typedef struct zynmidi_event_st {
+	uint32_t time;					// Jack frame time
+	uint8_t izmip;					// Source zmip
+	uint8_t flags;
+	uint8_t size;					// Message size, including status byte (max 255)
+	uint8_t status;
+	uint8_t data[ZYNMIDI_EVENT_DATA_SIZE];
+} zynmidi_event_t;
+
+int write_zynmidi_event(int izmip, jack_nframes_t time, uint8_t *buffer, size_t size, uint8_t flags);
+int read_zynmidi_events(zynmidi_event_t *out, int max);
+int get_zynmidi_events_count();
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,242 @@
+/*
+ * ******************************************************************
+ * ZYNTHIAN PROJECT: ZynMidiRouter Benchmark
+ *
+ * Drive the MIDI router with synthetic workloads, using the offline
+ * backend, and report throughput. No jackd or GPIO hardware needed.
+ *
+ * Copyright (C) 2015-2021 Fernando Moyano <jofemodo@zynthian.org>
+ *
+ * ******************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * For a full copy of the GNU General Public License see the LICENSE.txt file.
+ *
+ * ******************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "zynmidirouter.h"
+
+#define BENCH_NFRAMES 64
+#define BENCH_SAMPLE_RATE 48000
+#define BENCH_EVENTS_PER_CYCLE 64
+#define BENCH_DEFAULT_CYCLES 20000
+
+//-----------------------------------------------------------------------------
+// Workloads
+//-----------------------------------------------------------------------------
+
+typedef struct bench_workload_st {
+	const char *name;
+	void (*setup)();
+	//Fill event "i" of cycle "c" => Return the zmip
+	int (*get_event)(int c, int i, uint8_t *data, size_t *size);
+	int all_zmops;
+} bench_workload_t;
+
+uint32_t bench_rnd_seed=12345;
+
+uint32_t bench_rnd() {
+	bench_rnd_seed=bench_rnd_seed*1103515245+12345;
+	return (bench_rnd_seed >> 16) & 0x7FFF;
+}
+
+void setup_default() {
+}
+
+//Dense Note-On/Off on one device
+int get_event_notes(int c, int i, uint8_t *data, size_t *size) {
+	data[0]=(i & 1) ? 0x80 : 0x90;
+	data[1]=36+((c+i/2) % 60);
+	data[2]=100;
+	*size=3;
+	return ZMIP_DEV0;
+}
+
+void setup_cc_automode() {
+	set_midi_filter_cc_automode(1);
+}
+
+//CC flood, some of them with value 64 to trigger relative mode detection
+int get_event_cc(int c, int i, uint8_t *data, size_t *size) {
+	data[0]=0xB0 | (i & 0x3);
+	data[1]=1+(bench_rnd() % 100);
+	data[2]=(bench_rnd() % 4==0) ? 64 : bench_rnd() % 128;
+	*size=3;
+	return ZMIP_DEV0;
+}
+
+void setup_clone16() {
+	int i;
+	for (i=1;i<16;i++) set_midi_filter_clone(0, i, 1);
+}
+
+//Notes & CCs on channel 0, cloned to the other 15 channels
+int get_event_clone(int c, int i, uint8_t *data, size_t *size) {
+	if (i % 4==3) {
+		data[0]=0xB0;
+		data[1]=1+(i % 16);
+		data[2]=c & 0x7F;
+	} else {
+		data[0]=(i & 1) ? 0x80 : 0x90;
+		data[1]=36+((c+i/2) % 60);
+		data[2]=100;
+	}
+	*size=3;
+	return ZMIP_DEV0;
+}
+
+void setup_active_chan() {
+	set_midi_active_chan(5);
+}
+
+//Notes on every channel, from several devices, moved to the active channel
+int get_event_active_chan(int c, int i, uint8_t *data, size_t *size) {
+	data[0]=((i & 1) ? 0x80 : 0x90) | (i % 16);
+	data[1]=36+((c+i/2) % 60);
+	data[2]=100;
+	*size=3;
+	return ZMIP_DEV0+(i % 4);
+}
+
+void setup_event_map() {
+	int ch, n;
+	midi_filter_begin_batch();
+	for (ch=0;ch<16;ch++) {
+		for (n=0;n<128;n+=2) {
+			set_midi_filter_event_map(CTRL_CHANGE, ch, n, CTRL_CHANGE, (ch+1) % 16, 127-n);
+			set_midi_filter_event_map(NOTE_ON, ch, n, NOTE_ON, ch, (n+12) & 0x7F);
+		}
+	}
+	midi_filter_commit_batch();
+}
+
+//CCs & notes, half of them hitting a map
+int get_event_map(int c, int i, uint8_t *data, size_t *size) {
+	data[0]=((i & 1) ? 0xB0 : 0x90) | (bench_rnd() % 16);
+	data[1]=bench_rnd() % 128;
+	data[2]=1+(bench_rnd() % 127);
+	*size=3;
+	return ZMIP_DEV0;
+}
+
+//Notes on all channels from all devices, all zmops connected
+int get_event_all_zmops(int c, int i, uint8_t *data, size_t *size) {
+	data[0]=((i & 1) ? 0x80 : 0x90) | (i % 16);
+	data[1]=36+((c+i/2) % 60);
+	data[2]=100;
+	*size=3;
+	return ZMIP_DEV0+(i % NUM_ZMIP_DEVS);
+}
+
+bench_workload_t bench_workloads[]={
+	{ "dense_notes", setup_default, get_event_notes, 0 },
+	{ "cc_automode", setup_cc_automode, get_event_cc, 0 },
+	{ "clone_16", setup_clone16, get_event_clone, 0 },
+	{ "active_chan", setup_active_chan, get_event_active_chan, 0 },
+	{ "event_map", setup_event_map, get_event_map, 0 },
+	{ "all_zmops", setup_default, get_event_all_zmops, 1 },
+	{ NULL, NULL, NULL, 0 }
+};
+
+//-----------------------------------------------------------------------------
+// Benchmark
+//-----------------------------------------------------------------------------
+
+uint64_t bench_clock_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+//Emulate the UI, so the zynmidi buffers don't fill
+void bench_drain_ui() {
+	uint32_t evs[256];
+	zynmidi_event_t xevs[256];
+	while (read_zynmidi_batch(evs, 256)>0);
+	while (read_zynmidi_events(xevs, 256)>0);
+}
+
+int run_workload(bench_workload_t *wl, int n_cycles) {
+	int c, i, iz;
+	uint8_t data[3];
+	size_t size;
+	uint64_t n_in=0, n_out=0, t_total=0, t0;
+
+	if (!init_zynmidirouter_offline(BENCH_NFRAMES, BENCH_SAMPLE_RATE)) {
+		fprintf(stderr, "Can't init router with the offline backend\n");
+		return 0;
+	}
+	for (i=0;i<MAX_NUM_ZMOPS;i++) {
+		if (wl->all_zmops || i==ZMOP_MAIN || i==ZMOP_CH0) offline_zmop_set_connections(i, 1);
+		else offline_zmop_set_connections(i, 0);
+	}
+	wl->setup();
+	bench_rnd_seed=12345;
+
+	for (c=0;c<n_cycles;c++) {
+		for (i=0;i<BENCH_EVENTS_PER_CYCLE;i++) {
+			iz=wl->get_event(c, i, data, &size);
+			if (offline_zmip_push_event(iz, i*BENCH_NFRAMES/BENCH_EVENTS_PER_CYCLE, data, size)) n_in++;
+		}
+		t0=bench_clock_ns();
+		if (offline_process_cycle()<0) {
+			fprintf(stderr, "Cycle %d failed\n", c);
+			break;
+		}
+		t_total+=bench_clock_ns()-t0;
+		for (i=0;i<MAX_NUM_ZMOPS;i++) n_out+=offline_zmop_get_event_count(i);
+		bench_drain_ui();
+	}
+
+	double ns_event=n_in ? (double)t_total/n_in : 0.0;
+	double ns_cycle=c ? (double)t_total/c : 0.0;
+	printf("%-12s %10llu %10llu %12.0f %10.1f %10.1f %6.1f%%\n", wl->name,
+		(unsigned long long)n_in, (unsigned long long)n_out,
+		t_total ? 1e9*n_in/t_total : 0.0, ns_event, ns_cycle / 1000.0,
+		100.0*ns_cycle/(1e9*BENCH_NFRAMES/BENCH_SAMPLE_RATE));
+
+	end_zynmidirouter_offline();
+	return 1;
+}
+
+//-----------------------------------------------------------------------------
+// Main function
+//-----------------------------------------------------------------------------
+
+int main(int argc, char *argv[]) {
+	int i;
+	int n_cycles=BENCH_DEFAULT_CYCLES;
+	const char *only=NULL;
+
+	if (argc>1) n_cycles=atoi(argv[1]);
+	if (argc>2) only=argv[2];
+	if (n_cycles<=0) {
+		fprintf(stderr, "Usage: %s [cycles] [workload]\n", argv[0]);
+		return 1;
+	}
+
+	printf("ZynMidiRouter benchmark: %d cycles of %d frames @ %d Hz, %d events/cycle\n", n_cycles, BENCH_NFRAMES, BENCH_SAMPLE_RATE, BENCH_EVENTS_PER_CYCLE);
+	printf("%-12s %10s %10s %12s %10s %10s %7s\n", "workload", "events_in", "events_out", "events/s", "ns/event", "us/cycle", "period");
+	for (i=0;bench_workloads[i].name;i++) {
+		if (only && strcmp(only, bench_workloads[i].name)!=0) continue;
+		if (!run_workload(bench_workloads+i, n_cycles)) return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,361 @@
+/*
+ * ******************************************************************
+ * ZYNTHIAN PROJECT: ZynMidiRouter Trace Replay
+ *
+ * Replay a timestamped MIDI trace through the MIDI router, cycle by
+ * cycle, using the offline backend. Output events of every zmop are
+ * written to a file, for golden-file comparison, and the routing
+ * latency in frames is reported.
+ *
+ * Copyright (C) 2015-2021 Fernando Moyano <jofemodo@zynthian.org>
+ *
+ * ******************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * For a full copy of the GNU General Public License see the LICENSE.txt file.
+ *
+ * ******************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "zynmidirouter.h"
+
+//-----------------------------------------------------------------------------
+// Trace format
+//-----------------------------------------------------------------------------
+// Binary trace (host byte order):
+//   header => "ZMTR", uint32 version (1), uint32 sample rate
+//   record => uint64 frame, uint8 zmip, uint8 reserved, uint16 size, size bytes of MIDI message
+// Text trace, one event per line:
+//   <frame> <zmip> <hex bytes ...>
+//   "# rate <sample rate>" sets the trace sample rate, other "#" lines are comments
+// Frames are absolute, in time order. The first event is replayed at frame 0.
+// When the trace sample rate differs from the replay one, frames are rescaled.
+
+#define TRACE_MAGIC "ZMTR"
+#define TRACE_VERSION 1
+#define TRACE_MAX_EVENT_SIZE 256
+
+typedef struct trace_event_st {
+	uint64_t frame;
+	uint8_t izmip;
+	uint16_t size;
+	uint8_t data[TRACE_MAX_EVENT_SIZE];
+} trace_event_t;
+
+typedef struct trace_st {
+	FILE *fp;
+	int binary;
+	uint32_t sample_rate;
+	int line;
+} trace_t;
+
+int open_trace(trace_t *trace, const char *fpath) {
+	char magic[4];
+	uint32_t header[2];
+	memset(trace, 0, sizeof(trace_t));
+	trace->fp=fopen(fpath, "rb");
+	if (trace->fp==NULL) {
+		fprintf(stderr, "Can't open trace file '%s'\n", fpath);
+		return 0;
+	}
+	if (fread(magic, 1, 4, trace->fp)==4 && memcmp(magic, TRACE_MAGIC, 4)==0) {
+		if (fread(header, sizeof(uint32_t), 2, trace->fp)!=2 || header[0]!=TRACE_VERSION) {
+			fprintf(stderr, "Bad binary trace header in '%s'\n", fpath);
+			fclose(trace->fp);
+			return 0;
+		}
+		trace->binary=1;
+		trace->sample_rate=header[1];
+	} else {
+		rewind(trace->fp);
+	}
+	return 1;
+}
+
+//Read next event => 1 if read, 0 at end of trace, -1 on error
+int read_trace_event(trace_t *trace, trace_event_t *tev) {
+	if (trace->binary) {
+		uint8_t hdr[12];
+		if (fread(hdr, 1, 12, trace->fp)!=12) return 0;
+		memcpy(&tev->frame, hdr, 8);
+		tev->izmip=hdr[8];
+		memcpy(&tev->size, hdr+10, 2);
+		if (tev->size<1 || tev->size>TRACE_MAX_EVENT_SIZE) {
+			fprintf(stderr, "Bad event size (%d) in binary trace\n", tev->size);
+			return -1;
+		}
+		if (fread(tev->data, 1, tev->size, trace->fp)!=tev->size) return 0;
+		return 1;
+	}
+
+	char line[1024];
+	while (fgets(line, sizeof(line), trace->fp)) {
+		trace->line++;
+		char *p=line;
+		while (*p==' ' || *p=='\t') p++;
+		if (*p=='#') {
+			unsigned int rate;
+			if (sscanf(p, "# rate %u", &rate)==1) trace->sample_rate=rate;
+			continue;
+		}
+		if (*p=='\n' || *p=='\r' || *p==0) continue;
+
+		unsigned long long frame;
+		unsigned int iz, byte;
+		int n;
+		if (sscanf(p, "%llu %u%n", &frame, &iz, &n)!=2) {
+			fprintf(stderr, "Bad trace line %d\n", trace->line);
+			return -1;
+		}
+		p+=n;
+		tev->frame=frame;
+		tev->izmip=iz;
+		tev->size=0;
+		while (tev->size<TRACE_MAX_EVENT_SIZE && sscanf(p, "%x%n", &byte, &n)==1) {
+			tev->data[tev->size++]=byte;
+			p+=n;
+		}
+		if (tev->size==0) {
+			fprintf(stderr, "Empty event in trace line %d\n", trace->line);
+			return -1;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Latency measurement
+//-----------------------------------------------------------------------------
+// Output events are matched to the oldest pending input with the same message,
+// ignoring the MIDI channel (zmop translation, active channel & clones change it).
+// Events rewritten by maps, note-range or tuning are reported as unmatched.
+
+#define PENDING_SIZE 8192
+#define PENDING_MAX_CYCLES 16
+
+typedef struct pending_event_st {
+	uint64_t frame;
+	uint32_t matched_mask;			// Bit i set => already matched by zmop i
+	uint16_t size;
+	uint8_t data[TRACE_MAX_EVENT_SIZE];
+} pending_event_t;
+
+typedef struct latency_st {
+	uint64_t n_out;
+	uint64_t n_matched;
+	uint64_t total;
+	uint64_t max;
+} latency_t;
+
+jack_nframes_t replay_nframes=256;
+pending_event_t pending[PENDING_SIZE];
+int pending_head=0;
+int pending_n=0;
+latency_t latency[MAX_NUM_ZMOPS];
+
+void add_pending(uint64_t frame, uint8_t *data, size_t size) {
+	if (pending_n==PENDING_SIZE) {
+		pending_head=(pending_head+1) % PENDING_SIZE;
+		pending_n--;
+	}
+	pending_event_t *pev=pending+(pending_head+pending_n) % PENDING_SIZE;
+	pev->frame=frame;
+	pev->matched_mask=0;
+	pev->size=size;
+	memcpy(pev->data, data, size);
+	pending_n++;
+}
+
+void expire_pending(uint64_t frame) {
+	while (pending_n>0 && pending[pending_head].frame+PENDING_MAX_CYCLES*replay_nframes<frame) {
+		pending_head=(pending_head+1) % PENDING_SIZE;
+		pending_n--;
+	}
+}
+
+//Channel messages match on any channel when "any_chan" is set
+int same_message(uint8_t *a, size_t a_size, uint8_t *b, size_t b_size, int any_chan) {
+	if (a_size!=b_size) return 0;
+	if (any_chan && a[0]<0xF0) {
+		if ((a[0] & 0xF0)!=(b[0] & 0xF0)) return 0;
+	} else if (a[0]!=b[0]) return 0;
+	return memcmp(a+1, b+1, a_size-1)==0;
+}
+
+//Exact messages are matched first, so channel-insensitive matching doesn't steal inputs from other channels
+int find_pending(int iz, uint64_t frame, uint8_t *data, size_t size, int any_chan) {
+	int i;
+	for (i=0;i<pending_n;i++) {
+		pending_event_t *pev=pending+(pending_head+i) % PENDING_SIZE;
+		if (pev->frame>frame) break;
+		if (pev->matched_mask & (1<<iz)) continue;
+		if (same_message(pev->data, pev->size, data, size, any_chan)) return (pending_head+i) % PENDING_SIZE;
+	}
+	return -1;
+}
+
+void match_output(int iz, uint64_t frame, uint8_t *data, size_t size) {
+	latency[iz].n_out++;
+	int i=find_pending(iz, frame, data, size, 0);
+	if (i<0) i=find_pending(iz, frame, data, size, 1);
+	if (i<0) return;
+	pending[i].matched_mask|=(1<<iz);
+	uint64_t l=frame-pending[i].frame;
+	latency[iz].n_matched++;
+	latency[iz].total+=l;
+	if (l>latency[iz].max) latency[iz].max=l;
+}
+
+//-----------------------------------------------------------------------------
+// Replay
+//-----------------------------------------------------------------------------
+
+FILE *zmop_files[MAX_NUM_ZMOPS];
+
+int open_output_files(const char *outdir) {
+	int i;
+	char fpath[1024];
+	for (i=0;i<MAX_NUM_ZMOPS;i++) {
+		snprintf(fpath, sizeof(fpath), "%s/zmop_%02d.txt", outdir, i);
+		zmop_files[i]=fopen(fpath, "w");
+		if (zmop_files[i]==NULL) {
+			fprintf(stderr, "Can't open output file '%s'\n", fpath);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void close_output_files() {
+	int i;
+	for (i=0;i<MAX_NUM_ZMOPS;i++) {
+		if (zmop_files[i]) fclose(zmop_files[i]);
+		zmop_files[i]=NULL;
+	}
+}
+
+//Write the output of last cycle, starting at absolute frame "frame0"
+void write_outputs(uint64_t frame0) {
+	int i, k, j;
+	jack_midi_event_t ev;
+	for (i=0;i<MAX_NUM_ZMOPS;i++) {
+		int n=offline_zmop_get_event_count(i);
+		for (k=0;k<n;k++) {
+			if (!offline_zmop_get_event(i, k, &ev)) continue;
+			fprintf(zmop_files[i], "%llu", (unsigned long long)(frame0+ev.time));
+			for (j=0;j<ev.size;j++) fprintf(zmop_files[i], " %02x", ev.buffer[j]);
+			fprintf(zmop_files[i], "\n");
+			match_output(i, frame0+ev.time, ev.buffer, ev.size);
+		}
+	}
+}
+
+int replay_trace(trace_t *trace, jack_nframes_t nframes, jack_nframes_t sample_rate) {
+	trace_event_t tev;
+	uint64_t frame0=0, first_frame=0, frame;
+	uint64_t n_events=0, n_dropped=0;
+	int res, first=1;
+
+	res=read_trace_event(trace, &tev);
+	while (res>0) {
+		//Rescale to the replay sample rate
+		frame=tev.frame;
+		if (trace->sample_rate && trace->sample_rate!=sample_rate) frame=frame*sample_rate/trace->sample_rate;
+		if (first) {
+			first_frame=frame;
+			first=0;
+		}
+		frame-=first_frame;
+
+		//Run cycles until the event's cycle
+		while (frame>=frame0+nframes) {
+			if (offline_process_cycle()<0) return 0;
+			write_outputs(frame0);
+			frame0+=nframes;
+			expire_pending(frame0);
+		}
+
+		if (offline_zmip_push_event(tev.izmip, frame-frame0, tev.data, tev.size)) {
+			add_pending(frame, tev.data, tev.size);
+			n_events++;
+		} else {
+			n_dropped++;
+		}
+		res=read_trace_event(trace, &tev);
+	}
+	if (res<0) return 0;
+
+	//Last cycle & a few more for spilled events
+	int i;
+	for (i=0;i<PENDING_MAX_CYCLES;i++) {
+		if (offline_process_cycle()<0) return 0;
+		write_outputs(frame0);
+		frame0+=nframes;
+	}
+
+	printf("Replayed %llu events (%llu dropped) in %llu cycles of %d frames @ %d Hz\n",
+		(unsigned long long)n_events, (unsigned long long)n_dropped,
+		(unsigned long long)(frame0/nframes), nframes, sample_rate);
+	return 1;
+}
+
+void print_latency() {
+	int i;
+	printf("%-5s %10s %10s %10s %10s\n", "zmop", "events", "matched", "avg", "max");
+	for (i=0;i<MAX_NUM_ZMOPS;i++) {
+		if (latency[i].n_out==0) continue;
+		printf("%-5d %10llu %10llu %10.2f %10llu\n", i,
+			(unsigned long long)latency[i].n_out, (unsigned long long)latency[i].n_matched,
+			latency[i].n_matched ? (double)latency[i].total/latency[i].n_matched : 0.0,
+			(unsigned long long)latency[i].max);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Main function
+//-----------------------------------------------------------------------------
+
+int main(int argc, char *argv[]) {
+	trace_t trace;
+	jack_nframes_t sample_rate=48000;
+
+	if (argc<3) {
+		fprintf(stderr, "Usage: %s <trace> <output dir> [nframes] [sample rate]\n", argv[0]);
+		return 1;
+	}
+	if (argc>3) replay_nframes=atoi(argv[3]);
+	if (argc>4) sample_rate=atoi(argv[4]);
+
+	if (!open_trace(&trace, argv[1])) return 1;
+	if (!init_zynmidirouter_offline(replay_nframes, sample_rate)) return 1;
+	//Don't replay through a broken CC swap graph
+	if (!check_midi_filter_cc_swap()) {
+		fprintf(stderr, "Inconsistent MIDI filter CC swap config\n");
+		end_zynmidirouter_offline();
+		return 1;
+	}
+	if (!open_output_files(argv[2])) return 1;
+
+	int res=replay_trace(&trace, replay_nframes, sample_rate);
+	if (res) print_latency();
+
+	close_output_files();
+	fclose(trace.fp);
+	end_zynmidirouter_offline();
+	return res ? 0 : 1;
+}
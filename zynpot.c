@@ -25,24 +25,68 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <stdatomic.h>
 
 #include "zynpot.h"
 #include "zyncoder.h"
 #include "zynrv112.h"
 
+//-----------------------------------------------------------------------------
+// Zynpot MIDI reverse index
+//-----------------------------------------------------------------------------
+// First zynpot bound to each (chan, cc), as index+1 => 0 if none, so the
+// zero-initialized index is valid before reset_zynpots(). Zynpots sharing the
+// same binding are chained by "zynpot_midi_next" (index+1 too), so MIDI feedback
+// is a single lookup. Links are stored with release and walked with acquire, and
+// an unbound zynpot keeps its link, so a reader walking it while it's moved ends
+// in one of the chains and filters on the binding.
+
+atomic_int_least8_t zynpot_midi_index[16][128];
+atomic_int_least8_t zynpot_midi_next[MAX_NUM_ZYNPOTS];
+
+void unbind_midi_zynpot(uint8_t i) {
+	zynpot_t *zpt = zynpots + i;
+	atomic_int_least8_t *pj = &zynpot_midi_index[zpt->midi_chan][zpt->midi_cc];
+	int j;
+	while ((j=atomic_load_explicit(pj, memory_order_relaxed))>0) {
+		if (j==i+1) {
+			atomic_store_explicit(pj, atomic_load_explicit(&zynpot_midi_next[i], memory_order_relaxed), memory_order_release);
+			break;
+		}
+		pj = &zynpot_midi_next[j-1];
+	}
+}
+
+void bind_midi_zynpot(uint8_t i, uint8_t midi_chan, uint8_t midi_cc) {
+	zynpot_t *zpt = zynpots + i;
+	unbind_midi_zynpot(i);
+	zpt->midi_chan = midi_chan;
+	zpt->midi_cc = midi_cc;
+	atomic_store_explicit(&zynpot_midi_next[i], atomic_load_explicit(&zynpot_midi_index[midi_chan][midi_cc], memory_order_relaxed), memory_order_release);
+	atomic_store_explicit(&zynpot_midi_index[midi_chan][midi_cc], i+1, memory_order_release);
+}
+
 //-----------------------------------------------------------------------------
 // Zynpot common API
 //-----------------------------------------------------------------------------
 
 void reset_zynpots() {
 	int i;
+	init_zynui_eventfd();
+	for (i=0;i<16*128;i++) atomic_store(&zynpot_midi_index[i/128][i%128], 0);
 	for (i=0;i<MAX_NUM_ZYNPOTS;i++) {
 		zynpots[i].type = ZYNPOT_NONE;
 		zynpots[i].data = NULL;
 		zynpots[i].midi_chan = 0;
 		zynpots[i].midi_cc = 0;
+		atomic_store(&zynpot_midi_next[i], 0);
 		zynpots[i].osc_path[0] = 0;
+		bind_midi_zynpot(i, 0, 0);
 	}
 }
 
@@ -115,6 +159,7 @@ int set_value_zynpot(uint8_t i, int32_t v, int send) {
 	}
 	zynpots[i].set_value(zynpots[i].i, v);
 	zynpots[i].data->value_flag=1;
+	notify_zynui_event();
 	if (send) send_zynpot(i);
 	return 1;
 }
@@ -133,17 +178,15 @@ int set_value_noflag_zynpot(uint8_t i, int32_t v) {
 //-----------------------------------------------------------------------------
 
 int setup_midi_zynpot(uint8_t i, uint8_t midi_chan, uint8_t midi_cc) {
-	if (i>MAX_NUM_ZYNPOTS || zynpots[i].type==ZYNPOT_NONE) {
+	if (i>=MAX_NUM_ZYNPOTS || zynpots[i].type==ZYNPOT_NONE) {
 		printf("ZynCore: Zynpot index %d out of range!\n", i);
 		return 0;
 	}
-	zynpot_t *zpt = zynpots + i;
 
 	//Setup MIDI/OSC bindings
 	if (midi_chan>15) midi_chan=0;
 	if (midi_cc>127) midi_cc=1;
-	zpt->midi_chan = midi_chan;
-	zpt->midi_cc = midi_cc;
+	bind_midi_zynpot(i, midi_chan, midi_cc);
 
 	return 1;
 }
@@ -204,10 +247,14 @@ int send_zynpot(uint8_t i) {
 	return 1;
 }
 
-//Update zyncoder value => TODO Optimize this function!
+//Update the value of zynpots bound to (chan, cc)
 int midi_event_zynpot(uint8_t midi_chan, uint8_t midi_cc, uint8_t val) {
-	int i;
-	for (i=0;i<MAX_NUM_ZYNPOTS;i++) {
+	int i, j, n;
+	if (midi_chan>15 || midi_cc>127) return 0;
+	j = atomic_load_explicit(&zynpot_midi_index[midi_chan][midi_cc], memory_order_acquire);
+	for (n=0;j>0 && n<MAX_NUM_ZYNPOTS;n++) {
+		i=j-1;
+		j = atomic_load_explicit(&zynpot_midi_next[i], memory_order_acquire);
 		if (zynpots[i].type && zynpots[i].midi_chan==midi_chan && zynpots[i].midi_cc==midi_cc) {
 			zynpots[i].set_value(zynpots[i].i, val);
 			//TODO VERIFY THIS WORKS OK!!!
@@ -220,3 +267,35 @@ int midi_event_zynpot(uint8_t midi_chan, uint8_t midi_cc, uint8_t val) {
 }
 
 //-----------------------------------------------------------------------------
+// UI Event Notification
+//-----------------------------------------------------------------------------
+
+int zynui_eventfd=-1;
+pthread_once_t zynui_eventfd_once=PTHREAD_ONCE_INIT;
+
+void create_zynui_eventfd() {
+	zynui_eventfd=eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (zynui_eventfd<0) {
+		fprintf(stderr, "ZynCore: Can't create UI event notification fd!\n");
+	}
+}
+
+//Create the eventfd at init time, so it's never created from the RT thread
+int init_zynui_eventfd() {
+	pthread_once(&zynui_eventfd_once, create_zynui_eventfd);
+	return zynui_eventfd>=0;
+}
+
+int get_zynui_eventfd() {
+	pthread_once(&zynui_eventfd_once, create_zynui_eventfd);
+	return zynui_eventfd;
+}
+
+void notify_zynui_event() {
+	if (zynui_eventfd>=0) {
+		uint64_t v=1;
+		if (write(zynui_eventfd, &v, sizeof(v))<0) return;
+	}
+}
+
+//-----------------------------------------------------------------------------
@@ -96,6 +96,18 @@ int setup_osc_zynpot(uint8_t i, char *osc_path);
 int send_zynpot(uint8_t i);
 int midi_event_zynpot(uint8_t midi_chan, uint8_t midi_cc, uint8_t val);
 
+//-----------------------------------------------------------------------------
+// UI Event Notification
+//-----------------------------------------------------------------------------
+// An eventfd that is signalled when UI events are pending: zynmidi events,
+// switch & zynpot changes. The UI can poll/select on it, read it to clear it
+// and then drain all the sources. Long-press detection is time based, so it
+// still needs a poll timeout while a switch is pressed.
+
+int init_zynui_eventfd();
+int get_zynui_eventfd();
+void notify_zynui_event();
+
 //-----------------------------------------------------------------------------
 
 #ifdef __cplusplus